@@ -3,77 +3,706 @@
 #include <util/array2d.h>
 #include <util/array2dview.h>
 #include <util/array2dview_op.h>
-#include <mesh/hidden_surface_removal.hpp>
+#include <util/array3d.h>
 #include <mesh/mesh.hpp>
+#include <mesh/render_mesh.hpp>
+#include <util/thread_utility.hpp>
 
+#include <atomic>
+#include <cassert>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <vector>
 
 namespace detail {
-OpenMesh::Vec4f get_plane_parameters(OpenMesh::Vec3f const& p0,
-                                     OpenMesh::Vec3f const& p1,
-                                     OpenMesh::Vec3f const& p2) {
-  auto p0p1 = p1 - p0;
-  auto p0p2 = p2 - p0;
-  auto np = p0p1 % p0p2;  // normal to the plane (a, b, c) in plane equation
-  float d = -p0 | np;
-  return {np[0] / d, np[1] / d, np[2] / d, 1.0f};
-}
-
-int orient2d(OpenMesh::Vec3f const& p0, OpenMesh::Vec3f const& p1,
-             OpenMesh::Vec3f const& p2) {
-  return (p1[0] - p0[0]) * (p2[1] - p0[1]) - (p1[1] - p0[1]) * (p2[0] - p0[0]);
-}
-
-void fill_triangle(Mesh const& mesh, Mesh::FaceHandle face_handle, int label,
-                   Array2dView<int> labels, Array2dView<float> depth_map) {
-
-  auto fv_it = mesh.cfv_begin(face_handle);
-  OpenMesh::Vec3f p0 = mesh.point(*fv_it++);
-  OpenMesh::Vec3f p1 = mesh.point(*fv_it++);
-  OpenMesh::Vec3f p2 = mesh.point(*fv_it++);
-
-  auto pp = get_plane_parameters(p0, p1, p2);  // plane_parameters
-  if (std::abs(pp[2]) < 1e-4f) return;
-
-  int xmin = static_cast<int>(std::min({p0[0], p1[0], p2[0]}));
-  int xmax = static_cast<int>(std::max({p0[0], p1[0], p2[0]}));
-  int ymin = static_cast<int>(std::min({p0[1], p1[1], p2[1]}));
-  int ymax = static_cast<int>(std::max({p0[1], p1[1], p2[1]}));
-
-  // clipping
-  xmin = std::max(xmin, 0);
-  xmax = std::min(xmax, static_cast<int>(labels.GetSize1()) - 1);
-  ymin = std::max(ymin, 0);
-  ymax = std::min(ymax, static_cast<int>(labels.GetSize0()) - 1);
-  if (xmax < 0 || ymax < 0) return;
-
-  auto v0 = p0 - p1;
-  auto v1 = p1 - p2;
-  auto v2 = p2 - p0;
-
-  int A01 = p0[1] - p1[1], B01 = p1[0] - p0[0];
-  int A12 = p1[1] - p2[1], B12 = p2[0] - p1[0];
-  int A20 = p2[1] - p0[1], B20 = p0[0] - p2[0];
-
-  // Barycentric coordinates at minX/minY corner
-  OpenMesh::Vec3f init_point = {static_cast<float>(xmin),
-                                static_cast<float>(ymin), 0.0f};
-  int w0_row = orient2d(p1, p2, init_point);
-  int w1_row = orient2d(p2, p0, init_point);
-  int w2_row = orient2d(p0, p1, init_point);
-
-  float dz = -pp[0] / pp[2];
-  for (size_t row = ymin; row <= ymax; ++row) {
-    float z = -(pp[0] * xmin + pp[1] * row + pp[3]) / pp[2];
-    int w0 = w0_row;
-    int w1 = w1_row;
-    int w2 = w2_row;
-
-    for (int col = xmin; col <= xmax; ++col) {
-      if ((w0 | w1 | w2) >= 0 && z >= depth_map(row, col)) {
+// Projected vertices are snapped to 1/16 pixel (28.4 fixed point) and pixels
+// are sampled at integer coordinates. Edge functions are set up in 64 bits and
+// stepped in 32 bits along rows of at most max_row_width pixels; vertices
+// further than max_screen_coordinate from the origin are not representable.
+const int subpixel_bits = 4;
+const int subpixel_scale = 1 << subpixel_bits;
+const int max_row_width = 64;
+const float max_screen_coordinate = 1 << 14;
+
+bool is_representable(OpenMesh::Vec3f const& p) {
+  return std::abs(p[0]) < max_screen_coordinate &&
+         std::abs(p[1]) < max_screen_coordinate;
+}
+
+// Faces with a vertex that is not representable are clipped to the guard
+// band, a square around the image just inside the representable range, and
+// drawn as the triangles of the clipped polygon.
+const float guard_band = max_screen_coordinate - 1;
+
+// Clipping a triangle against the near plane and the four sides of the guard
+// band leaves a polygon of at most this many vertices.
+const int max_clipped_vertices = 8;
+
+// Point where the segment from a vertex inside a clip plane to one outside of
+// it crosses the plane, where distance(p) is the signed distance of p from the
+// plane, positive inside. The point is always computed from the inside vertex,
+// so neighbouring faces clipped along their shared edge get the same point.
+template <typename Distance>
+OpenMesh::Vec3f clip_edge(OpenMesh::Vec3f const& inside,
+                          OpenMesh::Vec3f const& outside, Distance distance) {
+  const float d_in = distance(inside), d_out = distance(outside);
+  return inside + (outside - inside) * (d_in / (d_in - d_out));
+}
+
+// Clips the convex polygon of n vertices in place to the side of a plane with
+// non-negative distance, keeping the order of the vertices, and returns the
+// number of vertices left.
+template <typename Distance>
+int clip_polygon(OpenMesh::Vec3f* polygon, int n, Distance distance) {
+  OpenMesh::Vec3f clipped[max_clipped_vertices];
+  int m = 0;
+  for (int i = 0; i < n; ++i) {
+    const auto& a = polygon[i];
+    const auto& b = polygon[(i + 1) % n];
+    const bool a_inside = distance(a) >= 0, b_inside = distance(b) >= 0;
+    if (a_inside) clipped[m++] = a;
+    if (a_inside && !b_inside) clipped[m++] = clip_edge(a, b, distance);
+    if (!a_inside && b_inside) clipped[m++] = clip_edge(b, a, distance);
+  }
+  assert(m <= max_clipped_vertices);
+  std::copy(clipped, clipped + m, polygon);
+  return m;
+}
+
+// Clips the polygon of n screen space vertices to the guard band. Depth is
+// linear in screen space, so it is interpolated along with x and y.
+int clip_to_guard_band(OpenMesh::Vec3f* polygon, int n) {
+  n = clip_polygon(polygon, n,
+                   [](OpenMesh::Vec3f const& p) { return p[0] + guard_band; });
+  n = clip_polygon(polygon, n,
+                   [](OpenMesh::Vec3f const& p) { return guard_band - p[0]; });
+  n = clip_polygon(polygon, n,
+                   [](OpenMesh::Vec3f const& p) { return p[1] + guard_band; });
+  n = clip_polygon(polygon, n,
+                   [](OpenMesh::Vec3f const& p) { return guard_band - p[1]; });
+  return n;
+}
+
+OpenMesh::Vec2i to_fixed(OpenMesh::Vec3f const& p) {
+  return {static_cast<int>(std::lrint(p[0] * subpixel_scale)),
+          static_cast<int>(std::lrint(p[1] * subpixel_scale))};
+}
+
+// Edge function of the directed edge v0 -> v1, E = A * col + B * row + C,
+// non-negative at pixels on the inner side. Pixels exactly on the edge only
+// belong to the triangle if it is a top or a left edge, so a pixel on an edge
+// shared by two triangles is written exactly once.
+struct EdgeFunction {
+  EdgeFunction(OpenMesh::Vec2i const& v0, OpenMesh::Vec2i const& v1) {
+    const int a = v0[1] - v1[1], b = v1[0] - v0[0];
+    const bool top_left = a > 0 || (a == 0 && b > 0);
+    A = a * subpixel_scale;
+    B = b * subpixel_scale;
+    C = -static_cast<int64_t>(a) * v0[0] - static_cast<int64_t>(b) * v0[1] -
+        (top_left ? 0 : 1);
+  }
+
+  // Value at the given pixel, clamped to a range that still leaves room for
+  // max_row_width steps without overflow or a change of sign.
+  int at(int col, int row) const {
+    const int64_t limit = 1 << 30;
+    const int64_t e = static_cast<int64_t>(A) * col +
+                      static_cast<int64_t>(B) * row + C;
+    return static_cast<int>(std::max(-limit, std::min(e, limit)));
+  }
+
+  int A, B;
+  int64_t C;
+};
+
+// Inclusive pixel rectangle [xmin, xmax] x [ymin, ymax].
+struct ScreenRect {
+  int xmin, ymin, xmax, ymax;
+};
+
+// Pixels sampled by a triangle with fixed-point vertices, clamped to the
+// image.
+ScreenRect triangle_bounds(OpenMesh::Vec2i const& v0,
+                           OpenMesh::Vec2i const& v1,
+                           OpenMesh::Vec2i const& v2, int width, int height) {
+  const int round_up = subpixel_scale - 1;
+  ScreenRect r;
+  r.xmin = std::max((std::min({v0[0], v1[0], v2[0]}) + round_up) >>
+                        subpixel_bits, 0);
+  r.xmax = std::min(std::max({v0[0], v1[0], v2[0]}) >> subpixel_bits,
+                    width - 1);
+  r.ymin = std::max((std::min({v0[1], v1[1], v2[1]}) + round_up) >>
+                        subpixel_bits, 0);
+  r.ymax = std::min(std::max({v0[1], v1[1], v2[1]}) >> subpixel_bits,
+                    height - 1);
+  return r;
+}
+
+// False if no pixel of the rectangle is inside all three edges. Each edge
+// function is linear, so its maximum over the rectangle is at a corner.
+bool may_overlap(ScreenRect const& r, EdgeFunction const& e01,
+                 EdgeFunction const& e12, EdgeFunction const& e20) {
+  for (const auto* e : {&e01, &e12, &e20}) {
+    if (e->at(e->A > 0 ? r.xmax : r.xmin, e->B > 0 ? r.ymax : r.ymin) < 0)
+      return false;
+  }
+  return true;
+}
+
+// Images a render writes to. Which of them are set depends on the output
+// policy.
+struct Target {
+  int width, height;
+  Array2dView<float> depth_map;
+  Array2dView<int> labels;
+  Array2dView<unsigned char> mask;
+  Array2dView<int64_t> visibility;
+};
+
+// The pixels of the target inside r, as a target of their own.
+Target sub_target(Target const& target, ScreenRect const& r) {
+  auto sub = [&r](auto const& view) {
+    return view.GetData()
+               ? view.SubView(r.ymin, r.xmin, r.ymax + 1, r.xmax + 1)
+               : view;
+  };
+  return {r.xmax - r.xmin + 1, r.ymax - r.ymin + 1, sub(target.depth_map),
+          sub(target.labels), sub(target.mask), sub(target.visibility)};
+}
+
+// Depth as an integer of the same order, as stored in visibility words. The
+// smallest integer is left over for empty pixels.
+inline int depth_key(float z) {
+  int32_t i;
+  std::memcpy(&i, &z, sizeof(i));
+  return i < 0 ? std::numeric_limits<int32_t>::min() - i : i;
+}
+
+inline float key_depth(int key) {
+  const int32_t i = key < 0 ? std::numeric_limits<int32_t>::min() - key : key;
+  float z;
+  std::memcpy(&z, &i, sizeof(z));
+  return z;
+}
+
+inline int64_t pack_visibility(int key, uint32_t face) {
+  return static_cast<int64_t>(static_cast<uint64_t>(static_cast<uint32_t>(key))
+                                  << 32 |
+                              face);
+}
+
+// Raises word to value unless it is larger already, also while other threads
+// do the same.
+inline void atomic_max(int64_t& word, int64_t value) {
+  int64_t current = __atomic_load_n(&word, __ATOMIC_RELAXED);
+  while (value > current &&
+         !__atomic_compare_exchange_n(&word, &current, value, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+#ifdef __SSE4__
+inline IVec DepthKey(FVec z) {
+  const IVec i = AsInt(z);
+  return Blend(CmpLt(i, Set1(0)),
+               Sub(Set1(std::numeric_limits<int32_t>::min()), i), i);
+}
+#endif
+
+// Block depth bounds come from a different evaluation order than the per-pixel
+// depths, so they are widened by a few ulps before being compared.
+inline float depth_slack(float z) { return 1e-5f * (std::abs(z) + 1.0f); }
+
+// Coarse depth buffer holding one value per block_size x block_size block of
+// the depth map: a lower bound of the depths stored in the block. A triangle
+// whose depth stays below it over the whole block cannot pass a single depth
+// test there. Depths only ever grow, so a stale bound stays valid and blocks
+// are only brought up to date now and then with update().
+struct HierarchicalZ {
+  static const int block_size = 8;
+
+  // Starts over for an empty depth map, or visibility buffer if the target
+  // has one. The block buffer is only reallocated when it grows.
+  void reset(Target const& target) {
+    depth_map = target.depth_map;
+    visibility = target.visibility;
+    height = target.height;
+    width = target.width;
+    zmin.Allocate((height + block_size - 1) / block_size,
+                  (width + block_size - 1) / block_size);
+    sil::fill(zmin, std::numeric_limits<float>::lowest());
+  }
+
+  // True if a depth of at most zmax fails the depth test everywhere in the
+  // rectangle.
+  bool hidden(ScreenRect const& r, float zmax) const {
+    zmax += depth_slack(zmax);
+    for (int by = r.ymin / block_size; by <= r.ymax / block_size; ++by)
+      for (int bx = r.xmin / block_size; bx <= r.xmax / block_size; ++bx)
+        if (zmax >= zmin(by, bx)) return false;
+    return true;
+  }
+
+  // Recomputes the bounds of all blocks overlapping the rectangle.
+  void update(ScreenRect const& r) {
+    for (int by = r.ymin / block_size; by <= r.ymax / block_size; ++by)
+      for (int bx = r.xmin / block_size; bx <= r.xmax / block_size; ++bx)
+        zmin(by, bx) = compute_block_min(by, bx);
+  }
+
+  float compute_block_min(int by, int bx) const {
+    const int row0 = by * block_size, col0 = bx * block_size;
+    const int rows = std::min(block_size, height - row0);
+    const int cols = std::min(block_size, width - col0);
+    if (visibility.GetSize0()) {
+      int64_t m = std::numeric_limits<int64_t>::max();
+      for (int row = row0; row < row0 + rows; ++row)
+        for (int c = 0; c < cols; ++c) m = std::min(m, visibility(row, col0 + c));
+      return m == empty_visibility ? std::numeric_limits<float>::lowest()
+                                   : key_depth(m >> 32);
+    }
+
+    float m = std::numeric_limits<float>::max();
+    int col = 0;
+#ifdef __SSE4__
+    const int lanes = sizeof(FVec) / sizeof(float);
+    if (cols == block_size) {
+      FVec mv = Set1(m);
+      for (int row = row0; row < row0 + rows; ++row)
+        for (col = 0; col < block_size; col += lanes)
+          mv = Min(mv, Load(&depth_map(row, col0 + col)));
+      float lane_min[lanes];
+      Store(lane_min, mv);
+      m = *std::min_element(lane_min, lane_min + lanes);
+    }
+#endif
+    for (int row = row0; row < row0 + rows; ++row)
+      for (int c = col; c < cols; ++c) m = std::min(m, depth_map(row, col0 + c));
+    return m;
+  }
+
+  Array2dView<float> depth_map;
+  Array2dView<int64_t> visibility;
+  int width, height;
+  Array2d<float> zmin;
+};
+
+// Number of pixels rasterized into a tile between two updates of its coarse
+// depth buffer.
+const int hiz_update_interval = 4096;
+
+// Smallest clipped bounding box area, in pixels, tested against the coarse
+// depth buffer.
+const int hiz_min_area = 32;
+
+// Triangles narrower and lower than micro_size pixels are rasterized by a
+// scalar path without vector setup.
+const int micro_size = 2;
+
+// Kernel flags of an output policy: depth is tested and written, labels are
+// written, or visibility words are tested and written. Without depth or
+// visibility only the mask is written, with no depth test. Atomic outputs are
+// written by workers drawing separate faces rather than separate tiles.
+// target() picks the images to write, using depth_scratch if the policy has
+// no depth image of its own; finish() post-processes them after all faces are
+// drawn, turning rasterized depth into camera depth. finish() only looks at
+// one pixel at a time, so may be called on parts of the target, see
+// sub_target.
+template <typename Output>
+struct OutputTraits;
+
+template <>
+struct OutputTraits<DepthAndLabelOutput> {
+  static const bool depth = true, labels = true, visibility = false;
+  static const bool atomic = false;
+
+  static Target target(DepthAndLabelOutput const& output, Array2d<float>&) {
+    return {static_cast<int>(output.labeled_image.GetSize1()),
+            static_cast<int>(output.labeled_image.GetSize0()),
+            output.depth_map, output.labeled_image, {}, {}};
+  }
+
+  template <typename CameraTraits>
+  static void finish(Target const& target, CameraTraits) {
+    sil::transform(target.depth_map, target.labels, target.depth_map,
+                   [](float d, int l) { return l ? CameraTraits::depth(d) : 0.0f; });
+  }
+};
+
+template <>
+struct OutputTraits<DepthOutput> {
+  static const bool depth = true, labels = false, visibility = false;
+  static const bool atomic = false;
+
+  static Target target(DepthOutput const& output, Array2d<float>&) {
+    return {static_cast<int>(output.depth_map.GetSize1()),
+            static_cast<int>(output.depth_map.GetSize0()),
+            output.depth_map, {}, {}, {}};
+  }
+
+  template <typename CameraTraits>
+  static void finish(Target const& target, CameraTraits) {
+    sil::transform(target.depth_map, target.depth_map, [](float d) {
+      return d == std::numeric_limits<float>::lowest()
+                 ? 0.0f
+                 : CameraTraits::depth(d);
+    });
+  }
+};
+
+template <>
+struct OutputTraits<LabelOutput> {
+  static const bool depth = true, labels = true, visibility = false;
+  static const bool atomic = false;
+
+  static Target target(LabelOutput const& output,
+                       Array2d<float>& depth_scratch) {
+    const int width = output.labeled_image.GetSize1();
+    const int height = output.labeled_image.GetSize0();
+    depth_scratch.Allocate(height, width);
+    return {width, height, depth_scratch, output.labeled_image, {}, {}};
+  }
+
+  template <typename CameraTraits>
+  static void finish(Target const&, CameraTraits) {}
+};
+
+template <>
+struct OutputTraits<MaskOutput> {
+  static const bool depth = false, labels = false, visibility = false;
+  static const bool atomic = false;
+
+  static Target target(MaskOutput const& output, Array2d<float>&) {
+    return {static_cast<int>(output.mask.GetSize1()),
+            static_cast<int>(output.mask.GetSize0()), {}, {}, output.mask, {}};
+  }
+
+  template <typename CameraTraits>
+  static void finish(Target const&, CameraTraits) {}
+};
+
+template <>
+struct OutputTraits<VisibilityOutput> {
+  static const bool depth = false, labels = false, visibility = true;
+  static const bool atomic = false;
+
+  static Target target(VisibilityOutput const& output, Array2d<float>&) {
+    return {static_cast<int>(output.visibility.GetSize1()),
+            static_cast<int>(output.visibility.GetSize0()),
+            {}, {}, {}, output.visibility};
+  }
+
+  template <typename CameraTraits>
+  static void finish(Target const&, CameraTraits) {}
+};
+
+template <>
+struct OutputTraits<FaceParallelVisibilityOutput> {
+  static const bool depth = false, labels = false, visibility = true;
+  static const bool atomic = true;
+
+  static Target target(FaceParallelVisibilityOutput const& output,
+                       Array2d<float>&) {
+    return {static_cast<int>(output.visibility.GetSize1()),
+            static_cast<int>(output.visibility.GetSize0()),
+            {}, {}, {}, output.visibility};
+  }
+
+  template <typename CameraTraits>
+  static void finish(Target const&, CameraTraits) {}
+};
+
+// Sets the images of target that the policy writes to their values before
+// any face is drawn.
+template <typename Traits>
+void clear_target(Target const& target) {
+  if (Traits::depth)
+    sil::fill(target.depth_map, std::numeric_limits<float>::lowest());
+  if (Traits::labels) sil::fill(target.labels, 0);
+  if (Traits::visibility) sil::fill(target.visibility, empty_visibility);
+  else if (!Traits::depth)
+    sil::fill(target.mask, static_cast<unsigned char>(0));
+}
+
+// Twice the area of the snapped triangle, positive if it is counter-clockwise.
+// Faces snapped to zero area, or flipped by snapping, cover no pixels.
+int64_t signed_area2(OpenMesh::Vec2i const& v0, OpenMesh::Vec2i const& v1,
+                     OpenMesh::Vec2i const& v2) {
+  return static_cast<int64_t>(v1[0] - v0[0]) * (v2[1] - v0[1]) -
+         static_cast<int64_t>(v1[1] - v0[1]) * (v2[0] - v0[0]);
+}
+
+// Positions of the vertices of a RenderMesh after the view transform, and the
+// same positions snapped to fixed point by snap(). Vertices are projected and
+// snapped in ranges, so that workers can share them.
+struct ScreenVertices {
+  void resize(size_t n) {
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+    fixed_x.resize(n);
+    fixed_y.resize(n);
+  }
+
+  OpenMesh::Vec3f point(uint32_t vertex) const {
+    return {x[vertex], y[vertex], z[vertex]};
+  }
+
+  void set_point(uint32_t vertex, OpenMesh::Vec3f const& p) {
+    x[vertex] = p[0];
+    y[vertex] = p[1];
+    z[vertex] = p[2];
+  }
+
+  OpenMesh::Vec2i fixed(uint32_t vertex) const {
+    return {fixed_x[vertex], fixed_y[vertex]};
+  }
+
+  // Vertices are snapped once, rather than once for every face using them.
+  // Positions that are not representable are snapped to meaningless values;
+  // their faces are clipped first and snapped on their own.
+  void snap(size_t begin, size_t end) {
+    size_t i = begin;
+#ifdef __SSE4__
+    const int lanes = sizeof(FVec) / sizeof(float);
+    const FVec scale = Set1(static_cast<float>(subpixel_scale));
+    for (; i + lanes <= end; i += lanes) {
+      Store(&fixed_x[i], ToInt(Mul(Load(&x[i]), scale)));
+      Store(&fixed_y[i], ToInt(Mul(Load(&y[i]), scale)));
+    }
+#endif
+    for (; i < end; ++i) {
+      const OpenMesh::Vec3f p{x[i], y[i], 0.0f};
+      const auto v = is_representable(p) ? to_fixed(p) : OpenMesh::Vec2i{0, 0};
+      fixed_x[i] = v[0];
+      fixed_y[i] = v[1];
+    }
+  }
+
+  std::vector<float> x, y, z;
+  std::vector<int> fixed_x, fixed_y;
+};
+
+// A face as it is rasterized: its screen positions with depth, counter-
+// clockwise, and the positions in fixed point.
+struct ScreenTriangle {
+  ScreenTriangle() = default;
+
+  ScreenTriangle(OpenMesh::Vec3f const& p0, OpenMesh::Vec3f const& p1,
+                 OpenMesh::Vec3f const& p2)
+      : p0(p0), p1(p1), p2(p2),
+        v0(to_fixed(p0)), v1(to_fixed(p1)), v2(to_fixed(p2)) {}
+
+  ScreenTriangle(ScreenVertices const& screen, uint32_t const* v)
+      : p0(screen.point(v[0])), p1(screen.point(v[1])),
+        p2(screen.point(v[2])), v0(screen.fixed(v[0])),
+        v1(screen.fixed(v[1])), v2(screen.fixed(v[2])) {}
+
+  OpenMesh::Vec3f p0, p1, p2;
+  OpenMesh::Vec2i v0, v1, v2;
+};
+
+// Rasterizes the part of the face inside clip and returns the number of pixels
+// visited. id is written to the label image, or to visibility words. The
+// snapped triangle has to be counter-clockwise, with a positive area.
+template <typename Output>
+int fill_triangle(ScreenTriangle const& t, int id, ScreenRect const& clip,
+                  HierarchicalZ const& hiz, Target const& target) {
+  typedef OutputTraits<Output> Traits;
+  Array2dView<float> depth_map = target.depth_map;
+  Array2dView<int> labels = target.labels;
+  Array2dView<unsigned char> mask = target.mask;
+  Array2dView<int64_t> visibility = target.visibility;
+  auto write_visibility = [id](int64_t& word, float z) {
+    const int64_t value = pack_visibility(depth_key(z), id);
+    if (Traits::atomic)
+      atomic_max(word, value);
+    else
+      word = std::max(word, value);
+  };
+
+  const auto &p0 = t.p0, &p1 = t.p1, &p2 = t.p2;
+  const auto &v0 = t.v0, &v1 = t.v1, &v2 = t.v2;
+  assert(signed_area2(v0, v1, v2) > 0);
+
+  auto bounds = triangle_bounds(v0, v1, v2, target.width, target.height);
+
+  // clipping to the tile
+  assert(clip.xmax - clip.xmin < max_row_width);
+  int xmin = std::max(bounds.xmin, clip.xmin);
+  int xmax = std::min(bounds.xmax, clip.xmax);
+  int ymin = std::max(bounds.ymin, clip.ymin);
+  int ymax = std::min(bounds.ymax, clip.ymax);
+  if (xmin > xmax || ymin > ymax) return 0;
+
+  // Depth is interpolated over the face's plane starting from p0, with the
+  // gradient taken from the plane's normal in screen space.
+  float dz = 0.0f, dz_row = 0.0f;
+  auto set_up_depth = [&] {
+    const auto normal = (p1 - p0) % (p2 - p0);
+    if (!(normal[2] > 0.0f)) return false;
+    dz = -normal[0] / normal[2];
+    dz_row = -normal[1] / normal[2];
+    return true;
+  };
+  auto z_at = [&](int col, int row) {
+    return p0[2] + dz * (col - p0[0]) + dz_row * (row - p0[1]);
+  };
+
+  // Micro triangles test a fixed block of pixels without branching on their
+  // shape, and most turn out to cover none, so depth is only set up after.
+  // Their edge functions, the same as EdgeFunction's, are small enough to
+  // evaluate in 32 bits relative to the block.
+  const int extent = micro_size * subpixel_scale;
+  if (std::max({v0[0], v1[0], v2[0]}) - std::min({v0[0], v1[0], v2[0]}) <
+          extent &&
+      std::max({v0[1], v1[1], v2[1]}) - std::min({v0[1], v1[1], v2[1]}) <
+          extent) {
+    const OpenMesh::Vec2i corner{xmin * subpixel_scale, ymin * subpixel_scale};
+    unsigned covered = (1u << micro_size * micro_size) - 1;
+    for (const auto& edge : {std::make_pair(v1, v2), std::make_pair(v2, v0),
+                             std::make_pair(v0, v1)}) {
+      const auto &a = edge.first, &b = edge.second;
+      const int A = a[1] - b[1], B = b[0] - a[0];
+      const int w = A * (corner[0] - a[0]) + B * (corner[1] - a[1]) -
+                    (A > 0 || (A == 0 && B > 0) ? 0 : 1);
+      for (int dy = 0; dy < micro_size; ++dy) {
+        for (int dx = 0; dx < micro_size; ++dx) {
+          const int bit = dy * micro_size + dx;
+          const int w_pixel = w + (dx * A + dy * B) * subpixel_scale;
+          covered &= ~(static_cast<unsigned>(w_pixel < 0) << bit);
+        }
+      }
+    }
+    for (int dy = 0; dy < micro_size; ++dy) {
+      for (int dx = 0; dx < micro_size; ++dx) {
+        if (xmin + dx > xmax || ymin + dy > ymax)
+          covered &= ~(1u << (dy * micro_size + dx));
+      }
+    }
+    if (!covered || !set_up_depth()) return 0;
+
+    int npixels = 0;
+    for (; covered; covered &= covered - 1, ++npixels) {
+      const int bit = __builtin_ctz(covered);
+      const int row = ymin + bit / micro_size, col = xmin + bit % micro_size;
+      const float z = z_at(col, row);
+      if (Traits::visibility) {
+        write_visibility(visibility(row, col), z);
+      } else if (!Traits::depth) {
+        mask(row, col) = 1;
+      } else if (z >= depth_map(row, col)) {
         depth_map(row, col) = z;
-        labels(row, col) = label;
+        if (Traits::labels) labels(row, col) = id;
+      }
+    }
+    return npixels;
+  }
+
+  if (!set_up_depth()) return 0;
+
+  const EdgeFunction e01(v0, v1), e12(v1, v2), e20(v2, v0);
+  const int A01 = e01.A, A12 = e12.A, A20 = e20.A;
+
+  // Triangles covering a few pixels are cheaper to rasterize than to test.
+  // Depth is linear, so its maximum over the clipped box is at a corner.
+  // The coarse depth buffer is only kept up to date when tiles are drawn by
+  // one worker each.
+  if ((Traits::depth || Traits::visibility) && !Traits::atomic &&
+      (xmax - xmin + 1) * (ymax - ymin + 1) >= hiz_min_area) {
+    const float zmax = z_at(xmin, ymin) +
+                       std::max(0.0f, dz * (xmax - xmin)) +
+                       std::max(0.0f, dz_row * (ymax - ymin));
+    if (hiz.hidden({xmin, ymin, xmax, ymax}, zmax)) return 0;
+  }
+
+#ifdef __SSE4__
+  // Lane offsets of the edge functions and depth within one vector step.
+  const int lanes = sizeof(FVec) / sizeof(float);
+  const IVec lane = Ramp(0);
+  const IVec dw0 = Mul(lane, Set1(A12));
+  const IVec dw1 = Mul(lane, Set1(A20));
+  const IVec dw2 = Mul(lane, Set1(A01));
+  const FVec dzv = Mul(ToFloat(lane), Set1(dz));
+  const IVec w0_step = Set1(lanes * A12);
+  const IVec w1_step = Set1(lanes * A20);
+  const IVec w2_step = Set1(lanes * A01);
+  const FVec z_step = Set1(lanes * dz);
+  const IVec zero = Set1(0);
+  const IVec idv = Set1(id);
+#endif
+
+  for (int row = ymin; row <= ymax; ++row) {
+    float z = z_at(xmin, row);
+    int w0 = e12.at(xmin, row);
+    int w1 = e20.at(xmin, row);
+    int w2 = e01.at(xmin, row);
+    int col = xmin;
+
+#ifdef __SSE4__
+    IVec w0v = Add(Set1(w0), dw0);
+    IVec w1v = Add(Set1(w1), dw1);
+    IVec w2v = Add(Set1(w2), dw2);
+    FVec zv = Add(Set1(z), dzv);
+
+    for (; col + lanes - 1 <= xmax; col += lanes) {
+      const Mask inside = CmpGe(Or(Or(w0v, w1v), w2v), zero);
+
+      if (Traits::visibility && Traits::atomic) {
+        if (!AllZero(inside)) {
+          int keys[lanes], covered[lanes];
+          Store(keys, DepthKey(zv));
+          Store(covered, inside);
+          for (int k = 0; k < lanes; ++k) {
+            if (covered[k])
+              atomic_max(visibility(row, col + k),
+                         pack_visibility(keys[k], id));
+          }
+        }
+      } else if (Traits::visibility) {
+        StoreMaxPacked(&visibility(row, col), DepthKey(zv), id, inside);
+      } else if (Traits::depth) {
+        float* depth_ptr = &depth_map(row, col);
+        FVec depth = Load(depth_ptr);
+        Mask pass = And(inside, CmpGe(zv, depth));
+        if (!AllZero(pass)) {
+          Store(depth_ptr, Blend(pass, zv, depth));
+          if (Traits::labels) {
+            int* label_ptr = &labels(row, col);
+            Store(label_ptr, Blend(pass, idv, Load(label_ptr)));
+          }
+        }
+      } else if (!AllZero(inside)) {
+        int covered[lanes];
+        Store(covered, inside);
+        for (int k = 0; k < lanes; ++k) mask(row, col + k) |= covered[k] & 1;
+      }
+
+      w0v = Add(w0v, w0_step);
+      w1v = Add(w1v, w1_step);
+      w2v = Add(w2v, w2_step);
+      zv = Add(zv, z_step);
+    }
+
+    // Remaining pixels of the row continue in the scalar loop.
+    const int nvector = col - xmin;
+    w0 += nvector * A12;
+    w1 += nvector * A20;
+    w2 += nvector * A01;
+    z += nvector * dz;
+#endif
+
+    for (; col <= xmax; ++col) {
+      if (Traits::visibility) {
+        if ((w0 | w1 | w2) >= 0) write_visibility(visibility(row, col), z);
+      } else if (!Traits::depth) {
+        if ((w0 | w1 | w2) >= 0) mask(row, col) = 1;
+      } else if ((w0 | w1 | w2) >= 0 && z >= depth_map(row, col)) {
+        depth_map(row, col) = z;
+        if (Traits::labels) labels(row, col) = id;
       }
       // One step to the right
       w0 += A12;
@@ -81,45 +710,690 @@ void fill_triangle(Mesh const& mesh, Mesh::FaceHandle face_handle, int label,
       w2 += A01;
       z += dz;
     }
+  }
+  return (xmax - xmin + 1) * (ymax - ymin + 1);
+}
+
+// Projection of a camera policy. project() computes screen positions and the
+// rasterized depth of the vertices begin .. end - 1, which is linear in screen
+// space and larger for closer points; depth() converts it back to the
+// camera's depth.
+// Faces turned towards the camera are counter-clockwise on screen unless
+// flip_winding is set. clip_near() writes the screen space polygon of the
+// face with vertices v left in front of the camera and returns its number of
+// vertices. towards_camera() is the model space direction in which points
+// come closer to the camera. pixels_per_unit() is the length in pixels of a
+// model unit near the model origin. view_planes() writes the camera space
+// half-spaces a x + b y + c z + d >= 0 bounding the points drawn inside the
+// screen rectangle xmin .. xmax, ymin .. ymax, and returns their number.
+template <typename Camera>
+struct CameraTraits;
+
+template <>
+struct CameraTraits<OrthographicCamera> {
+  static const bool flip_winding = false;
+
+  static void project(RenderMesh const& mesh, TransformationMatrix3d const& H,
+                      OrthographicCamera const&, ScreenVertices& screen,
+                      size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i)
+      screen.set_point(i, transform_vertex(mesh, H, i));
+  }
+
+  static OpenMesh::Vec3f towards_camera(TransformationMatrix3d const& H) {
+    return handedness(H) * model_view_direction(H, OpenMesh::Vec3f{0, 0, 1});
+  }
+
+  static int view_planes(OrthographicCamera const&, float xmin, float xmax,
+                         float ymin, float ymax, float (*planes)[4]) {
+    const float bounds[4][4] = {{1, 0, 0, -xmin},
+                                {-1, 0, 0, xmax},
+                                {0, 1, 0, -ymin},
+                                {0, -1, 0, ymax}};
+    std::memcpy(planes, bounds, sizeof(bounds));
+    return 4;
+  }
+
+  static int clip_near(RenderMesh const& mesh, TransformationMatrix3d const& H,
+                       OrthographicCamera const&, uint32_t const* v,
+                       OpenMesh::Vec3f* polygon) {
+    for (int k = 0; k < 3; ++k) polygon[k] = transform_vertex(mesh, H, v[k]);
+    return 3;
+  }
+
+  static float depth(float z) { return z; }
+
+  static float pixels_per_unit(OrthographicCamera const&,
+                               TransformationMatrix3d const& H) {
+    return similarity_scale(H);
+  }
+};
+
+// Rasterizes 1 / z, which unlike z is linear in screen space.
+template <>
+struct CameraTraits<PinholeCamera> {
+  static const bool flip_winding = true;
+
+  static void project(RenderMesh const& mesh, TransformationMatrix3d const& H,
+                      PinholeCamera const& camera, ScreenVertices& screen,
+                      size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const auto p = transform_vertex(mesh, H, i);
+      // Vertices in front of the near plane are made unrepresentable, so
+      // their faces go through clip_near().
+      if (!(p[2] >= camera.near_plane)) {
+        const float nan = std::numeric_limits<float>::quiet_NaN();
+        screen.set_point(i, {nan, nan, p[2]});
+        continue;
+      }
+      screen.set_point(i, project_point(camera, p));
+    }
+  }
+
+  static int clip_near(RenderMesh const& mesh, TransformationMatrix3d const& H,
+                       PinholeCamera const& camera, uint32_t const* v,
+                       OpenMesh::Vec3f* polygon) {
+    for (int k = 0; k < 3; ++k) polygon[k] = transform_vertex(mesh, H, v[k]);
+    const int n = clip_polygon(polygon, 3, [&camera](OpenMesh::Vec3f const& p) {
+      return p[2] - camera.near_plane;
+    });
+    for (int k = 0; k < n; ++k) polygon[k] = project_point(camera, polygon[k]);
+    return n;
+  }
+
+  // For z > 0, fx x / z + cx >= xmin iff fx x + (cx - xmin) z >= 0, etc.
+  static int view_planes(PinholeCamera const& camera, float xmin, float xmax,
+                         float ymin, float ymax, float (*planes)[4]) {
+    const float bounds[5][4] = {{camera.fx, 0, camera.cx - xmin, 0},
+                                {-camera.fx, 0, xmax - camera.cx, 0},
+                                {0, camera.fy, camera.cy - ymin, 0},
+                                {0, -camera.fy, ymax - camera.cy, 0},
+                                {0, 0, 1, -camera.near_plane}};
+    std::memcpy(planes, bounds, sizeof(bounds));
+    return 5;
+  }
+
+  static OpenMesh::Vec3f project_point(PinholeCamera const& camera,
+                                       OpenMesh::Vec3f const& p) {
+    const float inv_z = 1.0f / p[2];
+    return {camera.fx * p[0] * inv_z + camera.cx,
+            camera.fy * p[1] * inv_z + camera.cy, inv_z};
+  }
+
+  static OpenMesh::Vec3f towards_camera(TransformationMatrix3d const& H) {
+    return -handedness(H) * model_view_direction(H, OpenMesh::Vec3f{0, 0, 1});
+  }
+
+  static float depth(float inv_z) { return 1.0f / inv_z; }
+
+  // Origins at or behind the near plane get the finest level.
+  static float pixels_per_unit(PinholeCamera const& camera,
+                               TransformationMatrix3d const& H) {
+    const float z = H.element[2][3];
+    if (!(z > camera.near_plane)) return std::numeric_limits<float>::max();
+    return std::max(std::abs(camera.fx), std::abs(camera.fy)) *
+           similarity_scale(H) / z;
+  }
+};
+
+// Screen is split into tile_size x tile_size tiles. Every face is binned into
+// the tiles its bounding box touches, and tiles are then rasterized one after
+// another, so the depth and label block of the current tile stays in cache.
+struct TileBins {
+  static const int tile_size = max_row_width;
+
+  // A face of the mesh, or with clipped_flag set the index of a triangle of a
+  // clipped face in clipped.
+  struct Entry {
+    uint32_t face;
+    int label;
+  };
+
+  static const uint32_t clipped_flag = 1u << 31;
+
+  TileBins(int width, int height)
+      : width(width),
+        height(height),
+        ntiles_x((width + tile_size - 1) / tile_size),
+        ntiles_y((height + tile_size - 1) / tile_size),
+        bins(ntiles_x * ntiles_y) {}
+
+  void insert(ScreenTriangle const& t, uint32_t face, int label) {
+    bin(t, {face, label});
+  }
+
+  // Triangle of a clipped face, which is kept here as its vertices are not in
+  // the mesh.
+  struct ClippedTriangle {
+    ScreenTriangle triangle;
+    uint32_t face;
+  };
+
+  void insert_clipped(ScreenTriangle const& t, uint32_t face, int label) {
+    if (bin(t, {clipped_flag | static_cast<uint32_t>(clipped.size()), label}))
+      clipped.push_back({t, face});
+  }
+
+  ClippedTriangle const& clipped_triangle(uint32_t face) const {
+    return clipped[face & ~clipped_flag];
+  }
+
+  // Adds the entry to the tiles the triangle may overlap and returns false if
+  // there are none.
+  bool bin(ScreenTriangle const& t, Entry entry) {
+    const auto &v0 = t.v0, &v1 = t.v1, &v2 = t.v2;
+    // Trivially reject faces that do not overlap the image.
+    auto r = triangle_bounds(v0, v1, v2, width, height);
+    if (r.xmin > r.xmax || r.ymin > r.ymax) return false;
+
+    const int tx0 = r.xmin / tile_size, tx1 = r.xmax / tile_size;
+    const int ty0 = r.ymin / tile_size, ty1 = r.ymax / tile_size;
+    if (tx0 == tx1 && ty0 == ty1) {
+      bins[ty0 * ntiles_x + tx0].push_back(entry);
+      return true;
+    }
+
+    // Large faces skip the tiles of their bounding box they cannot cover.
+    const EdgeFunction e01(v0, v1), e12(v1, v2), e20(v2, v0);
+    bool binned = false;
+    for (int ty = ty0; ty <= ty1; ++ty) {
+      for (int tx = tx0; tx <= tx1; ++tx) {
+        const int tile = ty * ntiles_x + tx;
+        if (!may_overlap(tile_rect(tile), e01, e12, e20)) continue;
+        bins[tile].push_back(entry);
+        binned = true;
+      }
+    }
+    return binned;
+  }
+
+  // Empties all tiles but keeps their memory for the next frame.
+  void clear() {
+    for (auto& bin : bins) bin.clear();
+    clipped.clear();
+  }
+
+  ScreenRect tile_rect(int tile) const {
+    const int tx = tile % ntiles_x;
+    const int ty = tile / ntiles_x;
+    return {tx * tile_size, ty * tile_size,
+            std::min((tx + 1) * tile_size, width) - 1,
+            std::min((ty + 1) * tile_size, height) - 1};
+  }
+
+  int width;
+  int height;
+  int ntiles_x;
+  int ntiles_y;
+  std::vector<std::vector<Entry>> bins;
+  std::vector<ClippedTriangle> clipped;
+};
+
+const int max_view_planes = 5;
+
+// Sets visible[run] to 1 for the face runs of the mesh transformed by H whose
+// boxes in the mesh's bvh may reach into all the camera space half-spaces
+// planes, and to 0 for all others.
+void cull_face_runs(RenderMesh const& mesh, TransformationMatrix3d const& H,
+                    float const (*planes)[4], int nplanes,
+                    std::vector<unsigned char>& visible) {
+  // Half-spaces in model space: p . (H m) = (H^T p) . m
+  const auto& e = H.element;
+  float model[max_view_planes][4];
+  for (int k = 0; k < nplanes; ++k) {
+    for (int j = 0; j < 4; ++j) {
+      model[k][j] = planes[k][0] * e[0][j] + planes[k][1] * e[1][j] +
+                    planes[k][2] * e[2][j];
+    }
+    model[k][3] += planes[k][3];
+  }
+
+  visible.assign(n_face_runs(mesh), 0);
+  uint32_t stack[64];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    const uint32_t index = stack[--top];
+    const auto& node = mesh.bvh[index];
+    // The box is out of view if it is outside one half-space, and all its
+    // runs are in view if it is inside all of them.
+    bool outside = false, inside = true;
+    for (int k = 0; k < nplanes && !outside; ++k) {
+      float nearest = model[k][3], farthest = model[k][3];
+      for (int j = 0; j < 3; ++j) {
+        const float a = model[k][j] * node.lo[j];
+        const float b = model[k][j] * node.hi[j];
+        nearest += std::min(a, b);
+        farthest += std::max(a, b);
+      }
+      outside = farthest < 0;
+      inside = inside && nearest >= 0;
+    }
+    if (outside) continue;
+    if (inside || node.count == 1) {
+      for (uint32_t k = node.first; k < node.first + node.count; ++k)
+        visible[mesh.bvh_runs[k]] = 1;
+    } else {
+      stack[top++] = node.second;
+      stack[top++] = index + 1;
+    }
+  }
+}
+
+// Buffers of one render, kept from one frame to the next.
+struct FrameBuffers {
+  ScreenVertices screen;
+  std::vector<TileBins> tiles;  // one per worker
+  HierarchicalZ hiz;
+  Array2d<float> depth_scratch;
+  std::vector<unsigned char> visible_runs;
+};
+
+// Renders the mesh transformed by H. run(job) has to call job(worker) for
+// worker = 0 .. nworkers - 1 and return when all calls are done.
+template <typename Output, typename Camera, typename Run>
+void render_frame(RenderMesh const& mesh, TransformationMatrix3d const& H,
+                  Output const& output, Camera const& camera,
+                  FrameBuffers& frame, size_t nworkers, Run run) {
+  typedef OutputTraits<Output> Traits;
+  typedef CameraTraits<Camera> Projection;
+  const Target target = Traits::target(output, frame.depth_scratch);
+  const int width = target.width, height = target.height;
+
+  // Images that are not drawn tile by tile are cleared and finished by the
+  // workers in bands of rows.
+  auto band = [&](size_t worker) {
+    return sub_target(target, {0, int(height * worker / nworkers), width - 1,
+                               int(height * (worker + 1) / nworkers) - 1});
+  };
+  auto finish_bands = [&](size_t worker) {
+    Traits::finish(band(worker), Projection());
+  };
+  if (mesh.n_faces() == 0) {
+    auto clear_bands = [&](size_t worker) {
+      clear_target<Traits>(band(worker));
+      finish_bands(worker);
+    };
+    return run(clear_bands);
+  }
+
+  // Every worker projects and snaps its own range of vertices.
+  auto& screen = frame.screen;
+  const size_t nvertices = mesh.n_vertices();
+  screen.resize(nvertices);
+  auto project = [&](size_t worker) {
+    const size_t begin = nvertices * worker / nworkers;
+    const size_t end = nvertices * (worker + 1) / nworkers;
+    Projection::project(mesh, H, camera, screen, begin, end);
+    screen.snap(begin, end);
+    if (Traits::atomic) clear_target<Traits>(band(worker));
+  };
+  run(project);
+
+  // Vertex indices of face i in counter-clockwise screen order.
+  auto face_vertices = [&](size_t i, uint32_t* v) {
+    const uint32_t* face = &mesh.indices[3 * i];
+    v[0] = face[0];
+    v[1] = face[Projection::flip_winding ? 2 : 1];
+    v[2] = face[Projection::flip_winding ? 1 : 2];
+  };
+
+  // Faces are drawn in runs, front to back in the closest view order of the
+  // mesh if it has any, so the depth test rejects more hidden pixels, and in
+  // storage order otherwise. for_faces(begin, end, f) calls f(i) for the faces
+  // of the runs drawn begin-th up to end-th.
+  const size_t nfaces = mesh.n_faces();
+  const size_t nruns = n_face_runs(mesh);
+  const uint32_t* view_order = nullptr;
+  bool reversed = false;
+  if (!mesh.view_orders.empty()) {
+    const auto front = Projection::towards_camera(H);
+    float best = 0;
+    for (int k = 0; k < n_view_orders; ++k) {
+      const float cos_angle = front | view_order_axis(k);
+      if (std::abs(cos_angle) > best) {
+        best = std::abs(cos_angle);
+        view_order = &mesh.view_orders[k * nruns];
+        reversed = cos_angle < 0;
+      }
+    }
+  }
+
+  // Runs out of view are skipped if the mesh has a bounding volume hierarchy.
+  // The rectangle has a margin of a pixel for the snapping of vertices.
+  const bool cull = !mesh.bvh.empty();
+  auto& visible_runs = frame.visible_runs;
+  if (cull) {
+    float planes[max_view_planes][4];
+    const int nplanes =
+        Projection::view_planes(camera, -1, width, -1, height, planes);
+    cull_face_runs(mesh, H, planes, nplanes, visible_runs);
+  }
+
+  auto for_faces = [&](size_t begin, size_t end, auto f) {
+    for (size_t k = begin; k < end; ++k) {
+      size_t run = k;
+      if (view_order) run = view_order[reversed ? nruns - 1 - k : k];
+      if (cull && !visible_runs[run]) continue;
+      const size_t last = std::min((run + 1) * view_order_run, nfaces);
+      for (size_t i = run * view_order_run; i < last; ++i) f(i);
+    }
+  };
+
+  // True if the points are all on one side outside the image.
+  auto off_screen = [&](OpenMesh::Vec3f const* points, int n) {
+    float xmin = std::numeric_limits<float>::max(), xmax = -xmin;
+    float ymin = xmin, ymax = -xmin;
+    for (int k = 0; k < n; ++k) {
+      const auto& p = points[k];
+      xmin = std::min(xmin, p[0]);
+      xmax = std::max(xmax, p[0]);
+      ymin = std::min(ymin, p[1]);
+      ymax = std::max(ymax, p[1]);
+    }
+    return xmax < 0 || xmin > width - 1 || ymax < 0 || ymin > height - 1;
+  };
+
+  // Calls emit(triangle, clipped) for face i if it faces the camera, which is
+  // when it is counter-clockwise on screen. Faces turned away are culled by
+  // the sign of their area before anything else is set up, and faces snapped
+  // to zero area once they are snapped. Faces crossing the near plane or
+  // reaching beyond the guard band are clipped and emitted as a fan of
+  // triangles, unless they are off-screen.
+  auto set_up_face = [&](size_t i, auto emit) {
+    uint32_t v[3];
+    face_vertices(i, v);
+    const auto p0 = screen.point(v[0]);
+    const auto p1 = screen.point(v[1]);
+    const auto p2 = screen.point(v[2]);
+    // Vertices behind the near plane are NaN, and so is the area then.
+    const float area = (p1[0] - p0[0]) * (p2[1] - p0[1]) -
+                       (p1[1] - p0[1]) * (p2[0] - p0[0]);
+    if (area <= 0) return;
+
+    if (is_representable(p0) && is_representable(p1) &&
+        is_representable(p2)) {
+      if (signed_area2(screen.fixed(v[0]), screen.fixed(v[1]),
+                       screen.fixed(v[2])) > 0)
+        emit(ScreenTriangle(screen, v), false);
+      return;
+    }
+
+    // Vertices behind the near plane have no position on screen, so faces
+    // with any are only rejected once clipped.
+    const bool projected = std::isfinite(p0[0]) && std::isfinite(p1[0]) &&
+                           std::isfinite(p2[0]);
+    const OpenMesh::Vec3f corners[3] = {p0, p1, p2};
+    if (projected && off_screen(corners, 3)) return;
+    OpenMesh::Vec3f polygon[max_clipped_vertices];
+    int n = Projection::clip_near(mesh, H, camera, v, polygon);
+    if (!projected && off_screen(polygon, n)) return;
+    n = clip_to_guard_band(polygon, n);
+    for (int k = 1; k + 1 < n; ++k) {
+      const ScreenTriangle t(polygon[0], polygon[k], polygon[k + 1]);
+      if (signed_area2(t.v0, t.v1, t.v2) > 0) emit(t, true);
+    }
+  };
+
+  auto& hiz = frame.hiz;
+  if (Traits::atomic) {
+    // Workers take chunks of face runs and draw them straight into the image,
+    // clipped to the same tiles as binned faces, so depth is interpolated
+    // from the same origins and the words match VisibilityOutput's.
+    std::atomic<size_t> next_chunk(0);
+    const size_t chunk_size = 4096 / view_order_run;
+    const int tile_size = TileBins::tile_size;
+    auto draw_faces = [&](size_t) {
+      for (size_t begin = next_chunk++ * chunk_size; begin < nruns;
+           begin = next_chunk++ * chunk_size) {
+        const size_t end = std::min(begin + chunk_size, nruns);
+        for_faces(begin, end, [&](size_t i) {
+          set_up_face(i, [&](ScreenTriangle const& t, bool) {
+            const auto r = triangle_bounds(t.v0, t.v1, t.v2, width, height);
+            for (int y = r.ymin / tile_size * tile_size; y <= r.ymax;
+                 y += tile_size) {
+              for (int x = r.xmin / tile_size * tile_size; x <= r.xmax;
+                   x += tile_size) {
+                const ScreenRect tile = {x, y,
+                                         std::min(x + tile_size, width) - 1,
+                                         std::min(y + tile_size, height) - 1};
+                fill_triangle<Output>(t, i, tile, hiz, target);
+              }
+            }
+          });
+        });
+      }
+    };
+    run(draw_faces);
+    return run(finish_bands);
+  }
 
-    // One row step
-    w0_row += B12;
-    w1_row += B20;
-    w2_row += B01;
+  // Every worker bins its own range of faces. Tiles are then handed out to
+  // the workers one at a time; a tile is only ever written by the worker that
+  // took it, so no locking is needed on the output images. The worker clears
+  // the tile, draws its bins in worker order, which keeps the faces in
+  // drawing order, and finishes it.
+  auto& tiles = frame.tiles;
+  if (tiles.size() != nworkers || tiles[0].width != width ||
+      tiles[0].height != height) {
+    tiles.assign(nworkers, TileBins(width, height));
   }
+
+  auto bin_faces = [&](size_t worker) {
+    auto& bins = tiles[worker];
+    bins.clear();
+    for_faces(nruns * worker / nworkers, nruns * (worker + 1) / nworkers,
+              [&](size_t i) {
+                set_up_face(i, [&](ScreenTriangle const& t, bool clipped) {
+                  if (clipped)
+                    bins.insert_clipped(t, i, mesh.labels[i]);
+                  else
+                    bins.insert(t, i, mesh.labels[i]);
+                });
+              });
+  };
+  run(bin_faces);
+
+  hiz.reset(target);
+  std::atomic<size_t> next_tile(0);
+  const size_t ntiles = tiles[0].bins.size();
+  auto fill_tiles = [&](size_t) {
+    uint32_t v[3];
+    for (size_t tile = next_tile++; tile < ntiles; tile = next_tile++) {
+      const auto clip = tiles[0].tile_rect(tile);
+      clear_target<Traits>(sub_target(target, clip));
+      int nvisited = 0;
+      for (const auto& bins : tiles) {
+        for (const auto& entry : bins.bins[tile]) {
+          if (entry.face & TileBins::clipped_flag) {
+            const auto& clipped = bins.clipped_triangle(entry.face);
+            nvisited += fill_triangle<Output>(
+                clipped.triangle,
+                Traits::visibility ? clipped.face : entry.label, clip, hiz,
+                target);
+          } else {
+            face_vertices(entry.face, v);
+            nvisited += fill_triangle<Output>(
+                ScreenTriangle(screen, v),
+                Traits::visibility ? entry.face : entry.label, clip, hiz,
+                target);
+          }
+          if ((Traits::depth || Traits::visibility) &&
+              nvisited >= hiz_update_interval) {
+            hiz.update(clip);
+            nvisited = 0;
+          }
+        }
+      }
+      Traits::finish(sub_target(target, clip), Projection());
+    }
+  };
+  run(fill_tiles);
+}
+
+// Threads and buffers a RenderContext keeps from one render to the next.
+struct RenderScratch {
+  explicit RenderScratch(size_t nthreads)
+      : workers(nthreads), frames(nthreads) {}
+
+  WorkerPool workers;
+  std::vector<FrameBuffers> frames;  // one per worker for batches
+};
+
+template <typename T>
+Array2dView<T> slice(Array3d<T>& stack, int i) {
+  return Array2dView<T>(&stack(i, 0, 0), stack.GetSize1(), stack.GetSize2(),
+                        stack.GetSize2());
 }
 }
 
-void get_projected_depth_and_label(Mesh mesh, TransformationMatrix3d H,
-                                   Array2dView<int> labeled_image,
-                                   Array2dView<float> depth_map) {
-  transform_mesh(mesh, H);
+RenderContext::RenderContext(size_t nthreads)
+    : scratch(new detail::RenderScratch(std::max<size_t>(nthreads, 1))) {}
+
+RenderContext::~RenderContext() {}
+
+template <typename Output, typename Camera>
+void render_mesh(RenderMesh const& mesh, TransformationMatrix3d const& H,
+                 Output const& output, RenderContext& context,
+                 Camera const& camera) {
+  auto& scratch = *context.scratch;
+  detail::render_frame(mesh, H, output, camera, scratch.frames[0],
+                       scratch.workers.size(),
+                       [&](auto& job) { scratch.workers.run(job); });
+}
 
-  sil::fill(labeled_image, 0);
-  sil::fill(depth_map, std::numeric_limits<float>::lowest());
+#define INSTANTIATE_RENDER_MESH(Output, Camera)                            \
+  template void render_mesh(RenderMesh const&, TransformationMatrix3d const&, \
+                            Output const&, RenderContext&, Camera const&);
 
-  mesh.update_normals();
-  hidden_surface_removal(mesh, OpenMesh::Vec3f{0.0f, 0.0f, 1.0f});
+INSTANTIATE_RENDER_MESH(DepthAndLabelOutput, OrthographicCamera)
+INSTANTIATE_RENDER_MESH(DepthOutput, OrthographicCamera)
+INSTANTIATE_RENDER_MESH(LabelOutput, OrthographicCamera)
+INSTANTIATE_RENDER_MESH(MaskOutput, OrthographicCamera)
+INSTANTIATE_RENDER_MESH(VisibilityOutput, OrthographicCamera)
+INSTANTIATE_RENDER_MESH(FaceParallelVisibilityOutput, OrthographicCamera)
+INSTANTIATE_RENDER_MESH(DepthAndLabelOutput, PinholeCamera)
+INSTANTIATE_RENDER_MESH(DepthOutput, PinholeCamera)
+INSTANTIATE_RENDER_MESH(LabelOutput, PinholeCamera)
+INSTANTIATE_RENDER_MESH(MaskOutput, PinholeCamera)
+INSTANTIATE_RENDER_MESH(VisibilityOutput, PinholeCamera)
+INSTANTIATE_RENDER_MESH(FaceParallelVisibilityOutput, PinholeCamera)
+#undef INSTANTIATE_RENDER_MESH
 
-  for (const auto& face : mesh.faces()) {
-    auto fv_it = mesh.cfv_begin(face);
-    auto c0 = mesh.color(*fv_it++);
-    auto c1 = mesh.color(*fv_it++);
-    auto c2 = mesh.color(*fv_it++);
-    if (c0 != c1 || c1 != c2) {
-      throw std::runtime_error(
-          "Vertex colors of one or several faces do not match. Cannot create "
-          "label image");
+template <typename Camera>
+void resolve_visibility(RenderMesh const& mesh,
+                        Array2dView<int64_t> visibility,
+                        Array2dView<int> labeled_image,
+                        Array2dView<float> depth_map, Camera const&) {
+  typedef detail::CameraTraits<Camera> Projection;
+  const size_t width = visibility.GetSize1();
+  for (size_t row = 0; row < visibility.GetSize0(); ++row) {
+    const int64_t* words = &visibility(row, 0);
+    int* labels = &labeled_image(row, 0);
+    float* depths = &depth_map(row, 0);
+    for (size_t col = 0; col < width; ++col) {
+      const int64_t word = words[col];
+      const bool empty = word == empty_visibility;
+      labels[col] = empty ? 0 : mesh.labels[visible_face(word)];
+      depths[col] =
+          empty ? 0.0f : Projection::depth(detail::key_depth(word >> 32));
     }
-    int r = c0[0], g = c0[1], b = c0[2];
-    int label = 256 * 256 * r + 256 * g + b;
-    if (mesh.data(face).visible) {
-      detail::fill_triangle(mesh, face, label, labeled_image, depth_map);
+  }
+}
+
+template void resolve_visibility(RenderMesh const&, Array2dView<int64_t>,
+                                 Array2dView<int>, Array2dView<float>,
+                                 OrthographicCamera const&);
+template void resolve_visibility(RenderMesh const&, Array2dView<int64_t>,
+                                 Array2dView<int>, Array2dView<float>,
+                                 PinholeCamera const&);
+
+template <typename Camera>
+RenderMesh const& select_lod(RenderLod const& lod,
+                             TransformationMatrix3d const& H,
+                             Camera const& camera) {
+  const float scale = detail::CameraTraits<Camera>::pixels_per_unit(camera, H);
+  return lod.levels[select_lod(lod.edge_lengths, scale)];
+}
+
+template RenderMesh const& select_lod(RenderLod const&,
+                                      TransformationMatrix3d const&,
+                                      OrthographicCamera const&);
+template RenderMesh const& select_lod(RenderLod const&,
+                                      TransformationMatrix3d const&,
+                                      PinholeCamera const&);
+
+void get_projected_depth_and_label(RenderMesh const& mesh,
+                                   TransformationMatrix3d const& H,
+                                   Array2dView<int> labeled_image,
+                                   Array2dView<float> depth_map,
+                                   RenderContext& context) {
+  render_mesh(mesh, H, DepthAndLabelOutput{labeled_image, depth_map}, context);
+}
+
+template <typename Camera>
+void get_projected_depth_and_label(
+    RenderMesh const& mesh, std::vector<TransformationMatrix3d> const& poses,
+    Array3d<int>& labeled_images, Array3d<float>& depth_maps,
+    RenderContext& context, Camera const& camera) {
+  const int npose = poses.size();
+  if (labeled_images.GetSize0() != npose || depth_maps.GetSize0() != npose ||
+      labeled_images.GetSize1() != depth_maps.GetSize1() ||
+      labeled_images.GetSize2() != depth_maps.GetSize2()) {
+    throw std::runtime_error(
+        "Label and depth stacks must hold one image of equal size per pose");
+  }
+
+  // With enough poses every worker renders whole poses on its own, which
+  // needs no synchronization within a frame. Otherwise poses are rendered
+  // one after another with the workers sharing each frame's tiles.
+  auto& scratch = *context.scratch;
+  const size_t nworkers = scratch.workers.size();
+  if (static_cast<size_t>(npose) < nworkers) {
+    for (int i = 0; i < npose; ++i) {
+      const DepthAndLabelOutput output{detail::slice(labeled_images, i),
+                                       detail::slice(depth_maps, i)};
+      render_mesh(mesh, poses[i], output, context, camera);
     }
+    return;
   }
 
-  sil::transform(depth_map, labeled_image, depth_map,
-                 [](float d, int l) { return l ? d : 0.0f; });
+  std::atomic<int> next_pose(0);
+  auto render_poses = [&](size_t worker) {
+    for (int i = next_pose++; i < npose; i = next_pose++) {
+      const DepthAndLabelOutput output{detail::slice(labeled_images, i),
+                                       detail::slice(depth_maps, i)};
+      detail::render_frame(mesh, poses[i], output, camera,
+                           scratch.frames[worker], 1,
+                           [](auto& job) { job(0); });
+    }
+  };
+  scratch.workers.run(render_poses);
+}
+
+template void get_projected_depth_and_label(
+    RenderMesh const&, std::vector<TransformationMatrix3d> const&,
+    Array3d<int>&, Array3d<float>&, RenderContext&, OrthographicCamera const&);
+template void get_projected_depth_and_label(
+    RenderMesh const&, std::vector<TransformationMatrix3d> const&,
+    Array3d<int>&, Array3d<float>&, RenderContext&, PinholeCamera const&);
+
+void get_projected_depth_and_label(RenderMesh const& mesh,
+                                   TransformationMatrix3d const& H,
+                                   Array2dView<int> labeled_image,
+                                   Array2dView<float> depth_map,
+                                   size_t nthreads) {
+  RenderContext context(nthreads);
+  get_projected_depth_and_label(mesh, H, labeled_image, depth_map, context);
+}
+
+void get_projected_depth_and_label(Mesh const& mesh,
+                                   TransformationMatrix3d const& H,
+                                   Array2dView<int> labeled_image,
+                                   Array2dView<float> depth_map,
+                                   size_t nthreads) {
+  get_projected_depth_and_label(make_render_mesh(mesh), H, labeled_image,
+                                depth_map, nthreads);
 }
 
 #ifdef STANDALONE_APP
@@ -131,18 +1405,20 @@ int main(int argc, char* argv[]) {
     std::exit(1);
   }
 
-  auto mesh = read_mesh(argv[1]);
+  auto mesh = make_render_mesh(read_mesh(argv[1]));
+  sort_faces_by_view(mesh);
+  build_face_bvh(mesh);
   TransformationMatrix3d H =
       sil::transformations::translate3d(250.0f, 250.0f, 0.0f) *
       sil::transformations::rotate3d(1.57f, 0.0f, 0.0f) *
       sil::transformations::scale3d(50);
 
-  mesh.update_normals();
   Array2d<float> depth_map(500, 500);
   Array2d<int> label(500, 500);
   auto start = std::chrono::high_resolution_clock::now();
+  RenderContext context(std::thread::hardware_concurrency());
   for (int i = 0; i < 100; ++i)
-    get_projected_depth_and_label(mesh, H, label, depth_map);
+    get_projected_depth_and_label(mesh, H, label, depth_map, context);
   auto end = std::chrono::high_resolution_clock::now();
   std::cout << "100 iterations lasted: "
             << std::chrono::duration_cast<std::chrono::milliseconds>(
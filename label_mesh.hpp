@@ -1,12 +1,155 @@
 #ifndef LABEL_MESH_HPP
 #define LABEL_MESH_HPP
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
 #include <util/array2dview.h>
+#include <util/array3d.h>
 #include <mesh/mesh.hpp>
+#include <mesh/render_mesh.hpp>
 #include <transformations/transformation_matrix.h>
 #include <transformations/transformations3d.hpp>
 
-void get_projected_depth_and_label(Mesh mesh, TransformationMatrix3d H,
+namespace detail {
+struct RenderScratch;
+}
+
+// Worker threads and scratch buffers reused from one render to the next.
+// Once a context has rendered an image of a given size, further renders of
+// that size do not allocate.
+struct RenderContext {
+  explicit RenderContext(size_t nthreads = 1);
+  ~RenderContext();
+
+  std::unique_ptr<detail::RenderScratch> scratch;
+};
+
+// Output policies of render_mesh, selecting the images a render writes. Each
+// policy compiles to its own rasterizer kernel touching only those images.
+
+// Depth and label image; depth is 0 where no face is drawn.
+struct DepthAndLabelOutput {
+  Array2dView<int> labeled_image;
+  Array2dView<float> depth_map;
+};
+
+// Depth image only; depth is 0 where no face is drawn.
+struct DepthOutput {
+  Array2dView<float> depth_map;
+};
+
+// Label image only. Depth is still tested, in a buffer kept by the context.
+struct LabelOutput {
+  Array2dView<int> labeled_image;
+};
+
+// Silhouette of the visible faces: 1 where any face is drawn, 0 elsewhere.
+// No depth is computed.
+struct MaskOutput {
+  Array2dView<unsigned char> mask;
+};
+
+// Visibility buffer: one word per pixel packing the depth of the visible face,
+// as an integer ordered like the depth, in the upper 32 bits and its face
+// index in the lower 32 bits. Pixels with no face hold empty_visibility.
+// Labels, depth or other face attributes are looked up afterwards, once per
+// pixel, e.g. by resolve_visibility. Of faces at equal depth the one with the
+// larger index is visible.
+struct VisibilityOutput {
+  Array2dView<int64_t> visibility;
+};
+
+// Same visibility buffer as VisibilityOutput, rendered by splitting the faces
+// among the context's workers instead of the screen tiles. Faces are drawn
+// straight into the buffer, without binning, and words are merged with an
+// atomic max, so the result is the same. This pays off for a large mesh at
+// low resolution, where binning costs more than it saves.
+struct FaceParallelVisibilityOutput {
+  Array2dView<int64_t> visibility;
+};
+
+const int64_t empty_visibility = std::numeric_limits<int64_t>::min();
+
+inline uint32_t visible_face(int64_t word) {
+  return static_cast<uint32_t>(word);
+}
+
+// Cameras of render_mesh, mapping points transformed by H to pixels.
+
+// x and y of the transformed points are pixel coordinates. The camera looks
+// along -z, so larger depth is closer.
+struct OrthographicCamera {};
+
+// Pinhole camera at the origin looking along +z, with pixel coordinates
+// (fx * x / z + cx, fy * y / z + cy). Depth is z, so smaller depth is closer.
+// Faces are clipped at near_plane.
+struct PinholeCamera {
+  float fx, fy, cx, cy;
+  float near_plane = 1e-3f;
+};
+
+// Renders the mesh transformed by H into the images of output, which is one
+// of the output policies above. Screen tiles are rasterized in parallel by
+// the context's worker threads. If the mesh was sorted by sort_faces_by_view,
+// faces are drawn roughly front to back, so more of the hidden ones are
+// rejected early. If it has a hierarchy built by build_face_bvh, faces out of
+// view are skipped in groups.
+template <typename Output, typename Camera = OrthographicCamera>
+void render_mesh(RenderMesh const& mesh, TransformationMatrix3d const& H,
+                 Output const& output, RenderContext& context,
+                 Camera const& camera = Camera());
+
+// Level of lod to render the mesh transformed by H at, the coarsest whose
+// edges cover about two pixels in the camera's image, see select_lod. For a
+// pinhole camera the scale at the model origin is used.
+template <typename Camera = OrthographicCamera>
+RenderMesh const& select_lod(RenderLod const& lod,
+                             TransformationMatrix3d const& H,
+                             Camera const& camera = Camera());
+
+// Writes the label and depth of the face visible in every pixel of a
+// visibility buffer rendered with the given camera, 0 where no face is.
+template <typename Camera = OrthographicCamera>
+void resolve_visibility(RenderMesh const& mesh,
+                        Array2dView<int64_t> visibility,
+                        Array2dView<int> labeled_image,
+                        Array2dView<float> depth_map,
+                        Camera const& camera = Camera());
+
+// Renders depth and label image of the mesh transformed by H, same as
+// render_mesh with a DepthAndLabelOutput.
+void get_projected_depth_and_label(RenderMesh const& mesh,
+                                   TransformationMatrix3d const& H,
+                                   Array2dView<int> labeled_image,
+                                   Array2dView<float> depth_map,
+                                   RenderContext& context);
+
+// Renders the mesh for every pose into the images labeled_images(i, :, :) and
+// depth_maps(i, :, :), which must be allocated to poses.size() x height x
+// width. The context's workers render separate poses in parallel.
+template <typename Camera = OrthographicCamera>
+void get_projected_depth_and_label(
+    RenderMesh const& mesh, std::vector<TransformationMatrix3d> const& poses,
+    Array3d<int>& labeled_images, Array3d<float>& depth_maps,
+    RenderContext& context, Camera const& camera = Camera());
+
+// Same as the first overload with a context of nthreads workers created for
+// this call, for one-off renders: every call starts and joins its threads
+// and allocates all buffers anew. Code rendering more than once should keep a
+// RenderContext and pass it to the first overload instead.
+void get_projected_depth_and_label(RenderMesh const& mesh,
+                                   TransformationMatrix3d const& H,
+                                   Array2dView<int> labeled_image,
+                                   Array2dView<float> depth_map,
+                                   size_t nthreads = 1);
+
+// Same as above, also converting the mesh to a RenderMesh on every call.
+void get_projected_depth_and_label(Mesh const& mesh,
+                                   TransformationMatrix3d const& H,
                                    Array2dView<int> labeled_image,
-                                   Array2dView<float> depth_map);
+                                   Array2dView<float> depth_map,
+                                   size_t nthreads = 1);
 
 #endif
@@ -3,8 +3,12 @@
 
 #include <mesh/mesh.hpp>
 #include <mesh/edge.hpp>
+#include <mesh/hidden_surface_removal.hpp>
 #include <util/wrap_angles.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <vector>
 
 namespace detail {
@@ -36,6 +40,18 @@ static inline bool is_edge_visible(Mesh const &mesh, Mesh::EdgeHandle handle,
 
   return true;
 }
+
+static inline void push_edge(Mesh const &mesh, Mesh::EdgeHandle handle,
+                             std::vector<Edge> &edges) {
+  auto point0 =
+      mesh.point(mesh.to_vertex_handle(mesh.halfedge_handle(handle, 0)));
+  auto point1 =
+      mesh.point(mesh.from_vertex_handle(mesh.halfedge_handle(handle, 0)));
+
+  edges.emplace_back(
+      std::make_pair(sil::Vec3f{point0[0], point0[1], point0[2]},
+                     sil::Vec3f{point1[0], point1[1], point1[2]}));
+}
 }
 
 static std::vector<Edge> edge_detection(Mesh const &mesh,
@@ -49,16 +65,270 @@ static std::vector<Edge> edge_detection(Mesh const &mesh,
 
   for (; e_it != end_it; e_it++) {
     if (detail::is_edge_visible(mesh, *e_it, minimum_normal_angle_diff)) {
-      auto point0 =
-          mesh.point(mesh.to_vertex_handle(mesh.halfedge_handle(*e_it, 0)));
-      auto point1 =
-          mesh.point(mesh.from_vertex_handle(mesh.halfedge_handle(*e_it, 0)));
-
-      visible_edges.emplace_back(
-          std::make_pair(sil::Vec3f{point0[0], point0[1], point0[2]},
-                         sil::Vec3f{point1[0], point1[1], point1[2]}));
+      detail::push_edge(mesh, *e_it, visible_edges);
+    }
+  }
+
+  return visible_edges;
+}
+
+// Flat edge to face adjacency of a mesh. Edge e joins faces faces[2 * e] and
+// faces[2 * e + 1], -1 on a boundary, and runs from vertex vertices[2 * e] to
+// vertices[2 * e + 1]. Face f has edges face_edges[3 * f] up to
+// face_edges[3 * f + 2]. creases lists the edges whose faces' normals differ
+// by at least the angle the adjacency was made with; they do not depend on
+// the view, so are found once.
+struct EdgeAdjacency {
+  std::vector<int> faces;
+  std::vector<uint32_t> vertices;
+  std::vector<uint32_t> face_edges;
+  std::vector<uint32_t> creases;
+};
+
+// The mesh's normals must be up to date.
+static EdgeAdjacency make_edge_adjacency(Mesh const &mesh,
+                                         float minimum_normal_angle_diff) {
+  EdgeAdjacency adjacency;
+  adjacency.faces.reserve(2 * mesh.n_edges());
+  adjacency.vertices.reserve(2 * mesh.n_edges());
+  adjacency.face_edges.resize(3 * mesh.n_faces());
+  std::vector<uint8_t> face_degree(mesh.n_faces(), 0);
+
+  // Same threshold as detail::angle, compared without the acos.
+  const float max_cos = std::cos(minimum_normal_angle_diff);
+  for (const auto &edge : mesh.edges()) {
+    const auto halfedge = mesh.halfedge_handle(edge, 0);
+    const auto face0 = mesh.face_handle(halfedge);
+    const auto face1 = mesh.face_handle(mesh.halfedge_handle(edge, 1));
+    adjacency.faces.push_back(face0.idx());
+    adjacency.faces.push_back(face1.idx());
+    adjacency.vertices.push_back(mesh.to_vertex_handle(halfedge).idx());
+    adjacency.vertices.push_back(mesh.from_vertex_handle(halfedge).idx());
+    for (const int face : {face0.idx(), face1.idx()}) {
+      if (face != -1)
+        adjacency.face_edges[3 * face + face_degree[face]++] = edge.idx();
+    }
+
+    if (face0.idx() == -1 || face1.idx() == -1) continue;
+    const auto n0 = mesh.normal(face0);
+    const auto n1 = mesh.normal(face1);
+    if (!(dot(n0, n1) - 1e-6f > max_cos * n0.norm() * n1.norm())) {
+      adjacency.creases.push_back(edge.idx());
+    }
+  }
+  return adjacency;
+}
+
+// Same edges as above for the faces set in visible_bits, see
+// visible_face_bits, and listed in visible, see visible_faces: the
+// silhouette edges, which have exactly one visible face, followed by the
+// creases between two visible faces. Only the edges of visible faces are
+// looked at, and no normals are compared.
+static std::vector<Edge> edge_detection(
+    Mesh const &mesh, EdgeAdjacency const &adjacency,
+    std::vector<uint64_t> const &visible_bits,
+    std::vector<uint32_t> const &visible) {
+
+  std::vector<Edge> visible_edges;
+
+  auto push_edge = [&](size_t e) {
+    auto point0 = mesh.point(Mesh::VertexHandle(adjacency.vertices[2 * e]));
+    auto point1 =
+        mesh.point(Mesh::VertexHandle(adjacency.vertices[2 * e + 1]));
+    visible_edges.emplace_back(
+        std::make_pair(sil::Vec3f{point0[0], point0[1], point0[2]},
+                       sil::Vec3f{point1[0], point1[1], point1[2]}));
+  };
+
+  for (const uint32_t face : visible) {
+    for (int k = 0; k < 3; ++k) {
+      const uint32_t e = adjacency.face_edges[3 * face + k];
+      const int other = adjacency.faces[2 * e] == int(face)
+                            ? adjacency.faces[2 * e + 1]
+                            : adjacency.faces[2 * e];
+      if (!is_visible(visible_bits, other)) push_edge(e);
+    }
+  }
+  for (const uint32_t e : adjacency.creases) {
+    if (is_visible(visible_bits, adjacency.faces[2 * e]) &&
+        is_visible(visible_bits, adjacency.faces[2 * e + 1])) {
+      push_edge(e);
+    }
+  }
+
+  return visible_edges;
+}
+
+// Node of a hierarchy over the edges of an EdgeAdjacency, see
+// build_silhouette_tree. The node holds edges edges[first] up to
+// edges[first + count - 1], and all normals of their faces are within the
+// cone around the unit axis whose half angle has cosine cos_angle and sine
+// sin_angle. Inner nodes have two children, the next node and node second.
+struct NormalConeNode {
+  OpenMesh::Vec3f axis;
+  float cos_angle, sin_angle;
+  uint32_t first, count;
+  uint32_t second;
+};
+
+// Hierarchy of normal cones over the edges between two faces, and the list
+// of boundary edges, which have a single face.
+struct SilhouetteTree {
+  std::vector<NormalConeNode> nodes;
+  std::vector<uint32_t> edges;
+  std::vector<uint32_t> boundaries;
+};
+
+// Edges in a leaf of a SilhouetteTree.
+const uint32_t silhouette_leaf_edges = 16;
+
+namespace detail {
+// Appends the node of edges[first] .. edges[first + count - 1] and its
+// subtree to nodes, splitting the edges at the median of their mean normals
+// along the axis those spread most.
+static void build_cone_node(std::vector<NormalConeNode> &nodes,
+                            std::vector<uint32_t> &edges,
+                            EdgeAdjacency const &adjacency,
+                            FaceNormals const &normals, uint32_t first,
+                            uint32_t count) {
+  auto normal = [&normals](int face) {
+    return OpenMesh::Vec3f(normals.x[face], normals.y[face], normals.z[face]);
+  };
+  auto mean_normal = [&](uint32_t edge) {
+    return normal(adjacency.faces[2 * edge]) +
+           normal(adjacency.faces[2 * edge + 1]);
+  };
+
+  OpenMesh::Vec3f sum(0, 0, 0);
+  OpenMesh::Vec3f lo = mean_normal(edges[first]), hi = lo;
+  for (uint32_t k = first; k < first + count; ++k) {
+    sum += mean_normal(edges[k]);
+    lo.minimize(mean_normal(edges[k]));
+    hi.maximize(mean_normal(edges[k]));
+  }
+
+  // A cone that does not fit in a hemisphere is never skipped.
+  NormalConeNode node{OpenMesh::Vec3f(0, 0, 1), -1.0f, 0.0f, first, count, 0};
+  if (sum.norm() > 0) {
+    node.axis = sum / sum.norm();
+    node.cos_angle = 1.0f;
+    for (uint32_t k = first; k < first + count; ++k) {
+      for (int side = 0; side < 2; ++side) {
+        const int face = adjacency.faces[2 * edges[k] + side];
+        const float c = dot(node.axis, normal(face));
+        if (!(c >= node.cos_angle)) node.cos_angle = c;
+      }
+    }
+    const float c = node.cos_angle;
+    node.sin_angle = std::sqrt(std::max(0.0f, 1 - c * c));
+  }
+  const size_t index = nodes.size();
+  nodes.push_back(node);
+  if (count <= silhouette_leaf_edges) return;
+
+  const auto extent = hi - lo;
+  const int axis = extent[0] >= std::max(extent[1], extent[2])
+                       ? 0
+                       : (extent[1] >= extent[2] ? 1 : 2);
+  const uint32_t half = count / 2;
+  std::nth_element(edges.begin() + first, edges.begin() + first + half,
+                   edges.begin() + first + count,
+                   [&](uint32_t a, uint32_t b) {
+                     return mean_normal(a)[axis] < mean_normal(b)[axis];
+                   });
+  build_cone_node(nodes, edges, adjacency, normals, first, half);
+  nodes[index].second = nodes.size();
+  build_cone_node(nodes, edges, adjacency, normals, first + half,
+                  count - half);
+}
+}
+
+// Builds the hierarchy of the edges of adjacency, with the face normals of
+// the same mesh. Edges that join faces of similar normals end up in the same
+// subtrees, so a view only descends into the few subtrees whose cones it is
+// nearly perpendicular to.
+static SilhouetteTree build_silhouette_tree(EdgeAdjacency const &adjacency,
+                                            FaceNormals const &normals) {
+  SilhouetteTree tree;
+  const uint32_t n_edges = adjacency.faces.size() / 2;
+  for (uint32_t e = 0; e < n_edges; ++e) {
+    if (adjacency.faces[2 * e] == -1 || adjacency.faces[2 * e + 1] == -1) {
+      tree.boundaries.push_back(e);
+    } else {
+      tree.edges.push_back(e);
     }
   }
+  if (tree.edges.empty()) return tree;
+  tree.nodes.reserve(4 * tree.edges.size() / silhouette_leaf_edges + 1);
+  detail::build_cone_node(tree.nodes, tree.edges, adjacency, normals, 0,
+                          tree.edges.size());
+  return tree;
+}
+
+// Same edges as the overload taking the visible faces, without testing all
+// faces: silhouette edges are only searched in the subtrees of the tree
+// whose cones straddle the plane perpendicular to view, so the cost grows
+// with the number of silhouette edges rather than of all edges.
+static std::vector<Edge> edge_detection(Mesh const &mesh,
+                                        EdgeAdjacency const &adjacency,
+                                        SilhouetteTree const &tree,
+                                        FaceNormals const &normals,
+                                        OpenMesh::Vec3f const &view) {
+
+  std::vector<Edge> visible_edges;
+
+  auto push_edge = [&](uint32_t e) {
+    auto point0 = mesh.point(Mesh::VertexHandle(adjacency.vertices[2 * e]));
+    auto point1 =
+        mesh.point(Mesh::VertexHandle(adjacency.vertices[2 * e + 1]));
+    visible_edges.emplace_back(
+        std::make_pair(sil::Vec3f{point0[0], point0[1], point0[2]},
+                       sil::Vec3f{point1[0], point1[1], point1[2]}));
+  };
+  auto is_visible = [&](uint32_t e, int side) {
+    return faces_view(normals, view, adjacency.faces[2 * e + side]);
+  };
+
+  // The cone bounds are compared against the threshold for a unit view,
+  // with a margin for the rounding of the normals.
+  const float view_norm = view.norm();
+  const float margin = 1e-4f;
+  const float threshold = facing_threshold / view_norm;
+
+  uint32_t stack[64];
+  int top = 0;
+  if (!tree.nodes.empty()) stack[top++] = 0;
+  while (top > 0) {
+    const uint32_t index = stack[--top];
+    const auto &node = tree.nodes[index];
+    if (node.cos_angle > 0) {
+      // Normals at angle phi to the view, and cone half angle theta: the
+      // faces' dot products with view are at least cos(phi + theta) and at
+      // most cos(phi - theta) if phi >= theta.
+      const float c = dot(node.axis, view) / view_norm;
+      const float s = std::sqrt(std::max(0.0f, 1 - c * c));
+      const float lowest = c * node.cos_angle - s * node.sin_angle;
+      const float highest = c * node.cos_angle + s * node.sin_angle;
+      if (lowest >= threshold + margin) continue;
+      if (c < node.cos_angle && highest < threshold - margin) continue;
+    }
+    if (node.count <= silhouette_leaf_edges) {
+      for (uint32_t k = node.first; k < node.first + node.count; ++k) {
+        const uint32_t e = tree.edges[k];
+        if (is_visible(e, 0) != is_visible(e, 1)) push_edge(e);
+      }
+    } else {
+      stack[top++] = node.second;
+      stack[top++] = index + 1;
+    }
+  }
+
+  for (const uint32_t e : tree.boundaries) {
+    if (is_visible(e, 0) != is_visible(e, 1)) push_edge(e);
+  }
+  for (const uint32_t e : adjacency.creases) {
+    if (is_visible(e, 0) && is_visible(e, 1)) push_edge(e);
+  }
 
   return visible_edges;
 }
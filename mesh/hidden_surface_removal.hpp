@@ -1,9 +1,14 @@
 #ifndef HIDDEN_SURFACE_REMOVAL_HPP_
 #define HIDDEN_SURFACE_REMOVAL_HPP_
 
+#include <cstdint>
 #include <vector>
 
 #include <mesh/mesh.hpp>
+#include <util/sse_util.h>
+
+// Faces whose normal is closer to perpendicular to the view are hidden.
+const float facing_threshold = 1e-3f;
 
 static void hidden_surface_removal(Mesh &mesh, OpenMesh::Vec3f view) {
 
@@ -11,7 +16,7 @@ static void hidden_surface_removal(Mesh &mesh, OpenMesh::Vec3f view) {
   for (const auto& face : mesh.faces())  {
     const auto n0 = mesh.normal(face);
 
-    if (dot(n0, view) < 1e-3f) {
+    if (dot(n0, view) < facing_threshold) {
       mesh.data(face).visible = false;
     } else {
       mesh.data(face).visible = true;
@@ -19,4 +24,91 @@ static void hidden_surface_removal(Mesh &mesh, OpenMesh::Vec3f view) {
   }
 }
 
+// Face normals of a mesh as separate x, y and z arrays, so all faces can be
+// tested against a view at once. The arrays are padded to a multiple of 64
+// faces with zero normals, which face no view.
+struct FaceNormals {
+  size_t n_faces;
+  std::vector<float> x, y, z;
+};
+
+// The mesh's normals must be up to date.
+static FaceNormals get_face_normals(Mesh const &mesh) {
+  FaceNormals normals;
+  normals.n_faces = mesh.n_faces();
+  const size_t padded = (mesh.n_faces() + 63) / 64 * 64;
+  normals.x.assign(padded, 0.0f);
+  normals.y.assign(padded, 0.0f);
+  normals.z.assign(padded, 0.0f);
+  for (const auto& face : mesh.faces()) {
+    const auto n = mesh.normal(face);
+    normals.x[face.idx()] = n[0];
+    normals.y[face.idx()] = n[1];
+    normals.z[face.idx()] = n[2];
+  }
+  return normals;
+}
+
+// True if the face's normal faces view, tested as in hidden_surface_removal.
+// face may be -1, which faces no view.
+static inline bool faces_view(FaceNormals const &normals,
+                              OpenMesh::Vec3f const &view, int face) {
+  if (face < 0) return false;
+  const float d = normals.x[face] * view[0] + normals.y[face] * view[1] +
+                  normals.z[face] * view[2];
+  return d >= facing_threshold;
+}
+
+namespace detail {
+// Bit k is set if face 64 * block + k faces view, tested as in
+// hidden_surface_removal.
+static inline uint64_t visible_face_block(FaceNormals const &normals,
+                                          OpenMesh::Vec3f const &view,
+                                          size_t block) {
+  const size_t first = 64 * block;
+  uint64_t bits = 0;
+#ifdef __SSE4__
+  const int lanes = sizeof(FVec) / sizeof(float);
+  const FVec view_x = Set1(view[0]), view_y = Set1(view[1]);
+  const FVec view_z = Set1(view[2]), threshold = Set1(facing_threshold);
+  for (int k = 0; k < 64; k += lanes) {
+    const FVec d = Add(Add(Mul(Load(&normals.x[first + k]), view_x),
+                           Mul(Load(&normals.y[first + k]), view_y)),
+                       Mul(Load(&normals.z[first + k]), view_z));
+    bits |= static_cast<uint64_t>(MoveMask(CmpGe(d, threshold))) << k;
+  }
+#else
+  for (int k = 0; k < 64; ++k) {
+    if (faces_view(normals, view, first + k)) bits |= uint64_t(1) << k;
+  }
+#endif
+  return bits;
+}
+}
+
+// Sets bit i % 64 of bits[i / 64] if face i faces view. Unlike
+// hidden_surface_removal nothing is written to the mesh.
+static void visible_face_bits(FaceNormals const &normals,
+                              OpenMesh::Vec3f const &view,
+                              std::vector<uint64_t> &bits) {
+  bits.resize(normals.x.size() / 64);
+  for (size_t block = 0; block < bits.size(); ++block)
+    bits[block] = detail::visible_face_block(normals, view, block);
+}
+
+// Writes the indices of the faces set in bits, see visible_face_bits, to
+// visible, in increasing order.
+static void visible_faces(std::vector<uint64_t> const &bits,
+                          std::vector<uint32_t> &visible) {
+  visible.clear();
+  for (size_t block = 0; block < bits.size(); ++block) {
+    for (uint64_t b = bits[block]; b; b &= b - 1)
+      visible.push_back(64 * block + __builtin_ctzll(b));
+  }
+}
+
+static inline bool is_visible(std::vector<uint64_t> const &bits, int face) {
+  return face >= 0 && (bits[face / 64] >> (face % 64) & 1);
+}
+
 #endif
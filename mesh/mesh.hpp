@@ -7,6 +7,14 @@
 #include <OpenMesh/Core/Mesh/FinalMeshItemsT.hh>
 #include <OpenMesh/Tools/Subdivider/Uniform/SubdividerT.hh>
 #include <OpenMesh/Tools/Subdivider/Uniform/LoopT.hh>
+#include <OpenMesh/Tools/Decimater/DecimaterT.hh>
+#include <OpenMesh/Tools/Decimater/ModQuadricT.hh>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <util/fixed_size_matrix.hpp>
 #include <transformations/transformations3d.hpp>
@@ -15,16 +23,23 @@
 struct MeshTraits : public OpenMesh::DefaultTraits {
   FaceTraits {
     bool visible;
+    int label;
   };
 };
 
 typedef OpenMesh::TriMesh_ArrayKernelT<MeshTraits> Mesh;
 
+// Maps packed face colors to the labels rendered for them.
+typedef std::unordered_map<int, int> LabelMap;
+
 static OpenMesh::Vec3f compute_centroid(Mesh const&);
 static void transform_mesh(Mesh&, TransformationMatrix3d);
+static void assign_face_labels(Mesh&, LabelMap const&);
 
 // align centroid with coordinate axes origin?
-static Mesh read_mesh(std::string filename, bool align_centroid = true) {
+// Face labels are assigned from the vertex colors, see assign_face_labels.
+static Mesh read_mesh(std::string filename, bool align_centroid = true,
+                      LabelMap const& label_map = LabelMap()) {
 
   Mesh mesh;
   mesh.request_face_normals();
@@ -41,6 +56,7 @@ static Mesh read_mesh(std::string filename, bool align_centroid = true) {
   mesh.request_vertex_colors();
   mesh.request_face_colors();
   mesh.update_normals();
+  assign_face_labels(mesh, label_map);
 
   if (align_centroid) {
     auto mesh_centroid = compute_centroid(mesh);
@@ -53,6 +69,35 @@ static Mesh read_mesh(std::string filename, bool align_centroid = true) {
   return mesh;
 }
 
+// Sets the label of every face to its vertex color packed as
+// 256 * 256 * r + 256 * g + b, or to what label_map maps that to if it is not
+// empty. All vertices of a face must have the same color.
+static void assign_face_labels(Mesh& mesh, LabelMap const& label_map) {
+  for (const auto& face : mesh.faces()) {
+    auto fv_it = mesh.cfv_begin(face);
+    auto c0 = mesh.color(*fv_it++);
+    auto c1 = mesh.color(*fv_it++);
+    auto c2 = mesh.color(*fv_it++);
+    if (c0 != c1 || c1 != c2) {
+      throw std::runtime_error(
+          "Vertex colors of one or several faces do not match. Cannot create "
+          "label image");
+    }
+    int r = c0[0], g = c0[1], b = c0[2];
+    int label = 256 * 256 * r + 256 * g + b;
+
+    if (!label_map.empty()) {
+      auto it = label_map.find(label);
+      if (it == label_map.end()) {
+        throw std::runtime_error("Face color " + std::to_string(label) +
+                                 " has no entry in the label map");
+      }
+      label = it->second;
+    }
+    mesh.data(face).label = label;
+  }
+}
+
 static inline std::vector<OpenMesh::Vec3f> get_vertices(Mesh& mesh) {
   std::vector<OpenMesh::Vec3f> vertices;
 
@@ -62,12 +107,123 @@ static inline std::vector<OpenMesh::Vec3f> get_vertices(Mesh& mesh) {
   return vertices;
 }
 
+// Face labels are kept. As labels come from vertex colors, all faces around a
+// vertex have the same label; the faces added by subdivision take the label
+// of an original vertex next to them.
 static void subdivide_mesh(Mesh& mesh, int nsubdivisions = 1) {
+  std::vector<int> vertex_labels(mesh.n_vertices());
+  for (const auto& face : mesh.faces()) {
+    for (auto fv_it = mesh.cfv_begin(face); fv_it != mesh.cfv_end(face);
+         ++fv_it)
+      vertex_labels[fv_it->idx()] = mesh.data(face).label;
+  }
+
   OpenMesh::Subdivider::Uniform::LoopT<Mesh, float> subdivider;
   subdivider.attach(mesh);
   subdivider(nsubdivisions);
   subdivider.detach();
   mesh.update_normals();
+
+  // Every subdivision step adds vertices next to the ones of the step before.
+  const size_t noriginal = vertex_labels.size();
+  vertex_labels.resize(mesh.n_vertices(), 0);
+  std::vector<bool> labeled(mesh.n_vertices(), false);
+  std::fill(labeled.begin(), labeled.begin() + noriginal, true);
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (size_t i = noriginal; i < mesh.n_vertices(); ++i) {
+      if (labeled[i]) continue;
+      const auto vertex = mesh.vertex_handle(i);
+      for (auto vv_it = mesh.cvv_begin(vertex); vv_it != mesh.cvv_end(vertex);
+           ++vv_it) {
+        if (labeled[vv_it->idx()]) {
+          vertex_labels[i] = vertex_labels[vv_it->idx()];
+          labeled[i] = changed = true;
+          break;
+        }
+      }
+    }
+  }
+  for (const auto& face : mesh.faces())
+    mesh.data(face).label = vertex_labels[mesh.cfv_begin(face)->idx()];
+}
+
+// Collapses edges of the mesh by their quadric error until about nfaces faces
+// are left. Boundary vertices are kept, so the seams between label regions,
+// which are separate components, stay closed.
+static void simplify_mesh(Mesh& mesh, size_t nfaces) {
+  typedef OpenMesh::Decimater::DecimaterT<Mesh> Decimater;
+  typedef OpenMesh::Decimater::ModQuadricT<Mesh>::Handle ModQuadric;
+
+  mesh.request_vertex_status();
+  mesh.request_edge_status();
+  mesh.request_face_status();
+  for (const auto& vertex : mesh.vertices())
+    mesh.status(vertex).set_locked(mesh.is_boundary(vertex));
+
+  Decimater decimater(mesh);
+  ModQuadric quadric;
+  decimater.add(quadric);
+  decimater.module(quadric).unset_max_err();
+  decimater.initialize();
+  decimater.decimate_to_faces(0, nfaces);
+  mesh.garbage_collection();
+  mesh.update_normals();
+}
+
+static float mean_edge_length(Mesh const& mesh) {
+  double length = 0;
+  for (const auto& face : mesh.faces()) {
+    auto fv_it = mesh.cfv_begin(face);
+    const auto p0 = mesh.point(*fv_it++);
+    const auto p1 = mesh.point(*fv_it++);
+    const auto p2 = mesh.point(*fv_it++);
+    length += (p1 - p0).norm() + (p2 - p1).norm() + (p0 - p2).norm();
+  }
+  return mesh.n_faces() ? length / (3 * mesh.n_faces()) : 0.0f;
+}
+
+// Levels of detail of a mesh, finest first, with the mean edge length of
+// every level.
+struct MeshLod {
+  std::vector<Mesh> levels;
+  std::vector<float> edge_lengths;
+};
+
+// Levels subdivided nsubdivisions times down to once, the mesh itself, and
+// nsimplifications levels with a quarter of the faces of the level before
+// each, as long as they keep at least min_faces faces.
+static MeshLod make_mesh_lod(Mesh const& mesh, int nsubdivisions = 0,
+                             int nsimplifications = 3,
+                             size_t min_faces = 256) {
+  MeshLod lod;
+  for (int i = nsubdivisions; i > 0; --i) {
+    lod.levels.push_back(mesh);
+    subdivide_mesh(lod.levels.back(), i);
+  }
+  lod.levels.push_back(mesh);
+  for (int i = 0; i < nsimplifications; ++i) {
+    const size_t nfaces = lod.levels.back().n_faces() / 4;
+    if (nfaces < min_faces) break;
+    Mesh level = lod.levels.back();
+    simplify_mesh(level, nfaces);
+    lod.levels.push_back(std::move(level));
+  }
+  for (const auto& level : lod.levels)
+    lod.edge_lengths.push_back(mean_edge_length(level));
+  return lod;
+}
+
+// Index of the coarsest level whose mean edge, drawn at pixels_per_unit
+// pixels per model unit, spans at most edge_pixels pixels, or of the finest
+// level if none does.
+static size_t select_lod(std::vector<float> const& edge_lengths,
+                         float pixels_per_unit, float edge_pixels = 2.0f) {
+  size_t level = 0;
+  for (size_t i = 1; i < edge_lengths.size(); ++i) {
+    if (edge_lengths[i] * pixels_per_unit <= edge_pixels) level = i;
+  }
+  return level;
 }
 
 static size_t num_of_visible_faces(Mesh const& mesh) {
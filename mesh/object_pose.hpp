@@ -24,13 +24,14 @@ struct Pose {
   };
 };
 
-bool operator==(Pose const& a, Pose const& b) {
+static bool operator==(Pose const& a, Pose const& b) {
   return is_near(a.Tx, b.Tx, 1e-3) && is_near(a.Ty, b.Ty, 1e-3) &&
          is_near(a.Tz, b.Tz, 1e-3) && is_near(a.Rx, b.Rx, 1e-3) &&
          is_near(a.Ry, b.Ry, 1e-3) && is_near(a.Rz, b.Rz, 1e-3);
 }
 
-Pose transformation_matrix_to_pose(TransformationMatrix3d H, int option = 0) {
+static Pose transformation_matrix_to_pose(TransformationMatrix3d H,
+                                          int option = 0) {
   Pose pose;
   pose.Tx = H.element[0][3];
   pose.Ty = H.element[1][3];
@@ -59,21 +60,21 @@ Pose transformation_matrix_to_pose(TransformationMatrix3d H, int option = 0) {
   return pose;
 }
 
-TransformationMatrix3d pose_to_transformation_matrix(Pose const& pose) {
+static TransformationMatrix3d pose_to_transformation_matrix(Pose const& pose) {
   return sil::transformations::make_transform3d(pose.Tx, pose.Ty, pose.Tz,
                                                 pose.Rx, pose.Ry, pose.Rz);
 }
 
-TransformationMatrix3d pose_to_rotation_matrix(Pose const& pose) {
+static TransformationMatrix3d pose_to_rotation_matrix(Pose const& pose) {
   return sil::transformations::make_transform3d(0, 0, 0, pose.Rx, pose.Ry,
                                                 pose.Rz);
 }
 
-TransformationMatrix3d pose_to_translation_matrix(Pose const& pose) {
+static TransformationMatrix3d pose_to_translation_matrix(Pose const& pose) {
   return sil::transformations::make_transform3d(pose.Tx, pose.Ty, pose.Tz);
 }
 
-std::ostream& operator<<(std::ostream& out, Pose const& pose) {
+static std::ostream& operator<<(std::ostream& out, Pose const& pose) {
   out << pose.flatten[0] << " " << pose.flatten[1] << " " << pose.flatten[2]
       << " " << pose.flatten[3] << " " << pose.flatten[4] << " "
       << pose.flatten[5] << std::endl;
@@ -12,60 +12,111 @@
 using PointCloud = std::vector<sil::Vec3f>;
 using OrientedPointCloud = std::vector<std::tuple<sil::Vec3f, sil::Vec3f> >;
 
+// Number of points draw_line_between_two_points places on the line.
 template <typename Point>
-std::vector<Point> draw_line_between_two_points(
-    Point position, Point end_position, typename Point::value_type step_size) {
+size_t count_points_on_line(Point const& position, Point const& end_position,
+                            typename Point::value_type step_size) {
+  if (position == end_position) return 0;
+  return static_cast<size_t>(distance(position, end_position) / step_size) + 1;
+}
 
-  if (position == end_position) return std::vector<Point>();
+// Calls f(point) for the points of draw_line_between_two_points, without
+// storing them.
+template <typename Point, typename Function>
+void for_each_point_on_line(Point position, Point end_position,
+                            typename Point::value_type step_size,
+                            Function f) {
+  const size_t nsteps =
+      count_points_on_line(position, end_position, step_size);
+  if (nsteps == 0) return;
 
   Point direction = end_position - position;
   direction = normalize(direction) * step_size;
-  const size_t nsteps =
-      static_cast<size_t>(distance(position, end_position) / step_size) + 1;
-
-  std::vector<Point> contour;
   for (size_t i = 0; i < nsteps; i++) {
-    contour.emplace_back(position);
+    f(position);
     position = position + direction;
   }
+}
 
+template <typename Point>
+std::vector<Point> draw_line_between_two_points(
+    Point position, Point end_position, typename Point::value_type step_size) {
+
+  std::vector<Point> contour;
+  contour.reserve(count_points_on_line(position, end_position, step_size));
+  for_each_point_on_line(position, end_position, step_size,
+                         [&contour](Point const& p) { contour.push_back(p); });
   return contour;
 }
 
-static std::vector<PointOnEdge> generate_points_on_edge(std::vector<Edge> edges,
-                                           float step_size) {
-  std::vector<PointOnEdge> points_on_edge;
+// Number of points generated on the edges at step_size; the size of the
+// outputs of generate_points_on_edge and generate_oriented_point_cloud.
+static size_t count_points_on_edges(std::vector<Edge> const& edges,
+                                    float step_size) {
+  size_t npoints = 0;
+  for (const auto& edge : edges)
+    npoints += count_points_on_line(edge.first, edge.second, step_size);
+  return npoints;
+}
 
+// Calls f(point, edge) for every point sampled on the edges at step_size,
+// edges in order, without allocating.
+template <typename Function>
+void for_each_point_on_edges(std::vector<Edge> const& edges, float step_size,
+                             Function f) {
   for (const auto& edge : edges) {
-    auto line_points =
-        draw_line_between_two_points(edge.first, edge.second, step_size);
-
-    std::transform(line_points.begin(), line_points.end(),
-                   std::back_inserter(points_on_edge),
-                   [&edge](sil::Vec3f const & p)
-                       ->PointOnEdge { return std::make_pair(p, edge); });
+    for_each_point_on_line(edge.first, edge.second, step_size,
+                           [&](sil::Vec3f const& p) { f(p, edge); });
   }
-  return points_on_edge;
 }
 
-static OrientedPointCloud generate_oriented_point_cloud(std::vector<Edge> edges,
-                                                        float step_size) {
-  OrientedPointCloud oriented_point_cloud;
+// Replaces the points in points_on_edge, which allocates only if it is
+// short of capacity.
+static void generate_points_on_edge(std::vector<Edge> const& edges,
+                                    float step_size,
+                                    std::vector<PointOnEdge>& points_on_edge) {
+  points_on_edge.clear();
+  points_on_edge.reserve(count_points_on_edges(edges, step_size));
+  for_each_point_on_edges(edges, step_size,
+                          [&](sil::Vec3f const& p, Edge const& edge) {
+    points_on_edge.emplace_back(p, edge);
+  });
+}
 
-  for (const auto& edge : edges) {
-    const auto& e0 = edge.first;
-    const auto& e1 = edge.second;
-    auto line_points = draw_line_between_two_points(e0, e1, step_size);
+static std::vector<PointOnEdge> generate_points_on_edge(
+    std::vector<Edge> const& edges, float step_size) {
+  std::vector<PointOnEdge> points_on_edge;
+  generate_points_on_edge(edges, step_size, points_on_edge);
+  return points_on_edge;
+}
 
-    const sil::Vec3f edge_normal =
-        sil::Vec3f{e1[1] - e0[1], -(e1[0] - e0[0]), 0.0f};
+// Normal of a contour point on the edge, in the image plane.
+static inline sil::Vec3f edge_normal(Edge const& edge) {
+  const auto& e0 = edge.first;
+  const auto& e1 = edge.second;
+  return sil::Vec3f{e1[1] - e0[1], -(e1[0] - e0[0]), 0.0f};
+}
 
-    std::transform(line_points.begin(), line_points.end(),
-                   std::back_inserter(oriented_point_cloud),
-                   [edge_normal](sil::Vec3f const& p) {
-      return std::make_tuple(p, edge_normal);
+// Replaces the points in oriented_point_cloud, which allocates only if it is
+// short of capacity.
+static void generate_oriented_point_cloud(
+    std::vector<Edge> const& edges, float step_size,
+    OrientedPointCloud& oriented_point_cloud) {
+  oriented_point_cloud.clear();
+  oriented_point_cloud.reserve(count_points_on_edges(edges, step_size));
+  for (const auto& edge : edges) {
+    const sil::Vec3f normal = edge_normal(edge);
+    for_each_point_on_line(edge.first, edge.second, step_size,
+                           [&](sil::Vec3f const& p) {
+      oriented_point_cloud.emplace_back(p, normal);
     });
   }
+}
+
+static OrientedPointCloud generate_oriented_point_cloud(
+    std::vector<Edge> const& edges, float step_size) {
+  OrientedPointCloud oriented_point_cloud;
+  generate_oriented_point_cloud(edges, step_size, oriented_point_cloud);
   return oriented_point_cloud;
 }
 
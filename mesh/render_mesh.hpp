@@ -0,0 +1,253 @@
+#ifndef RENDER_MESH_HPP_
+#define RENDER_MESH_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include <mesh/mesh.hpp>
+
+// Node of a bounding volume hierarchy over the face runs of a mesh, see
+// build_face_bvh. The node bounds runs bvh_runs[first] up to
+// bvh_runs[first + count - 1] by the box lo .. hi. Inner nodes have two
+// children, the next node and node second.
+struct FaceBvhNode {
+  OpenMesh::Vec3f lo, hi;
+  uint32_t first, count;
+  uint32_t second;
+};
+
+// Flat copy of the data the rasterizer needs from a Mesh: vertex positions as
+// separate x, y and z arrays, three vertex indices per face, and per face its
+// label. view_orders optionally holds runs of faces sorted front to back for
+// a few view directions, see sort_faces_by_view, and bvh a hierarchy culling
+// runs outside the view, see build_face_bvh.
+struct RenderMesh {
+  size_t n_vertices() const { return x.size(); }
+  size_t n_faces() const { return labels.size(); }
+
+  std::vector<float> x, y, z;
+  std::vector<uint32_t> indices;
+  std::vector<int> labels;
+  std::vector<uint32_t> view_orders;
+  std::vector<FaceBvhNode> bvh;
+  std::vector<uint32_t> bvh_runs;
+};
+
+// Faces are ordered in runs of view_order_run consecutive faces, which are
+// usually close on the mesh. Drawing whole runs keeps the vertex accesses
+// about as local as in storage order. Run r holds faces view_order_run * r
+// up to view_order_run * (r + 1).
+const size_t view_order_run = 64;
+
+static size_t n_face_runs(RenderMesh const& mesh) {
+  return (mesh.n_faces() + view_order_run - 1) / view_order_run;
+}
+
+// Orderings are kept for the directions to the faces, edges and corners of a
+// cube. Of every opposite pair only one is stored, as the ordering of the
+// other one is the same reversed.
+const int n_view_orders = 13;
+
+static OpenMesh::Vec3f view_order_axis(int k) {
+  static const float axes[n_view_orders][3] = {
+      {1, 0, 0},  {0, 1, 0},  {0, 0, 1},  {1, 1, 0},   {1, -1, 0},
+      {1, 0, 1},  {1, 0, -1}, {0, 1, 1},  {0, 1, -1},  {1, 1, 1},
+      {1, 1, -1}, {1, -1, 1}, {1, -1, -1}};
+  return OpenMesh::Vec3f(axes[k][0], axes[k][1], axes[k][2]).normalize();
+}
+
+// Fills view_orders with n_view_orders orderings of the face runs, ordering k
+// sorted by decreasing position of the run centroids along
+// view_order_axis(k). It is front to back for a camera looking against the
+// axis, and back to front for one looking along it.
+static void sort_faces_by_view(RenderMesh& mesh) {
+  const size_t n = n_face_runs(mesh);
+  std::vector<float> position(n);
+  mesh.view_orders.resize(n_view_orders * n);
+  for (int k = 0; k < n_view_orders; ++k) {
+    const auto axis = view_order_axis(k);
+    std::fill(position.begin(), position.end(), 0.0f);
+    for (size_t i = 0; i < 3 * mesh.n_faces(); ++i) {
+      const uint32_t v = mesh.indices[i];
+      position[i / (3 * view_order_run)] +=
+          axis[0] * mesh.x[v] + axis[1] * mesh.y[v] + axis[2] * mesh.z[v];
+    }
+    const auto order = mesh.view_orders.begin() + k * n;
+    std::iota(order, order + n, 0);
+    std::stable_sort(order, order + n, [&position](uint32_t a, uint32_t b) {
+      return position[a] > position[b];
+    });
+  }
+}
+
+// Face labels are taken from the mesh's face data, as assigned by read_mesh.
+static RenderMesh make_render_mesh(Mesh const& mesh) {
+  RenderMesh render_mesh;
+
+  render_mesh.x.reserve(mesh.n_vertices());
+  render_mesh.y.reserve(mesh.n_vertices());
+  render_mesh.z.reserve(mesh.n_vertices());
+  for (const auto& vertex : mesh.vertices()) {
+    const auto& p = mesh.point(vertex);
+    render_mesh.x.push_back(p[0]);
+    render_mesh.y.push_back(p[1]);
+    render_mesh.z.push_back(p[2]);
+  }
+
+  render_mesh.indices.reserve(3 * mesh.n_faces());
+  render_mesh.labels.reserve(mesh.n_faces());
+  for (const auto& face : mesh.faces()) {
+    auto fv_it = mesh.cfv_begin(face);
+    const auto v0 = *fv_it++;
+    const auto v1 = *fv_it++;
+    const auto v2 = *fv_it++;
+    render_mesh.indices.push_back(v0.idx());
+    render_mesh.indices.push_back(v1.idx());
+    render_mesh.indices.push_back(v2.idx());
+    render_mesh.labels.push_back(mesh.data(face).label);
+  }
+  return render_mesh;
+}
+
+namespace detail {
+// Appends the node of runs[first] .. runs[first + count - 1] and its subtree
+// to bvh, splitting the runs at the median of their centers along the
+// longest axis of the centers' bounds.
+static void build_bvh_node(std::vector<FaceBvhNode>& bvh,
+                           std::vector<uint32_t>& runs,
+                           std::vector<OpenMesh::Vec3f> const& lo,
+                           std::vector<OpenMesh::Vec3f> const& hi,
+                           uint32_t first, uint32_t count) {
+  const size_t node = bvh.size();
+  bvh.push_back({lo[runs[first]], hi[runs[first]], first, count, 0});
+  OpenMesh::Vec3f center_lo = lo[runs[first]] + hi[runs[first]];
+  OpenMesh::Vec3f center_hi = center_lo;
+  for (uint32_t k = first; k < first + count; ++k) {
+    const uint32_t run = runs[k];
+    bvh[node].lo.minimize(lo[run]);
+    bvh[node].hi.maximize(hi[run]);
+    center_lo.minimize(lo[run] + hi[run]);
+    center_hi.maximize(lo[run] + hi[run]);
+  }
+  if (count == 1) return;
+
+  const auto extent = center_hi - center_lo;
+  const int axis = extent[0] >= std::max(extent[1], extent[2])
+                       ? 0
+                       : (extent[1] >= extent[2] ? 1 : 2);
+  const uint32_t half = count / 2;
+  std::nth_element(runs.begin() + first, runs.begin() + first + half,
+                   runs.begin() + first + count,
+                   [&](uint32_t a, uint32_t b) {
+                     return lo[a][axis] + hi[a][axis] <
+                            lo[b][axis] + hi[b][axis];
+                   });
+  build_bvh_node(bvh, runs, lo, hi, first, half);
+  bvh[node].second = bvh.size();
+  build_bvh_node(bvh, runs, lo, hi, first + half, count - half);
+}
+}
+
+// Builds bvh and bvh_runs, a bounding volume hierarchy whose leaves are the
+// face runs of the mesh. The rasterizer then skips the runs whose boxes are
+// out of view. Runs, rather than single faces, keep the faces drawn in
+// storage order; meshes whose consecutive faces are far apart are culled
+// poorly.
+static void build_face_bvh(RenderMesh& mesh) {
+  const size_t n = n_face_runs(mesh);
+  mesh.bvh.clear();
+  mesh.bvh_runs.resize(n);
+  if (n == 0) return;
+  std::vector<OpenMesh::Vec3f> lo(n), hi(n);
+  for (size_t i = 0; i < 3 * mesh.n_faces(); ++i) {
+    const uint32_t v = mesh.indices[i];
+    const OpenMesh::Vec3f p(mesh.x[v], mesh.y[v], mesh.z[v]);
+    const size_t run = i / (3 * view_order_run);
+    if (i % (3 * view_order_run) == 0) {
+      lo[run] = hi[run] = p;
+    } else {
+      lo[run].minimize(p);
+      hi[run].maximize(p);
+    }
+  }
+  std::iota(mesh.bvh_runs.begin(), mesh.bvh_runs.end(), 0);
+  mesh.bvh.reserve(2 * n - 1);
+  detail::build_bvh_node(mesh.bvh, mesh.bvh_runs, lo, hi, 0, n);
+}
+
+// Render meshes of the levels of a MeshLod, finest first.
+struct RenderLod {
+  std::vector<RenderMesh> levels;
+  std::vector<float> edge_lengths;
+};
+
+static RenderLod make_render_lod(MeshLod const& lod) {
+  RenderLod render_lod;
+  for (const auto& level : lod.levels)
+    render_lod.levels.push_back(make_render_mesh(level));
+  render_lod.edge_lengths = lod.edge_lengths;
+  return render_lod;
+}
+
+// Position of vertex i of the mesh transformed by H.
+static OpenMesh::Vec3f transform_vertex(RenderMesh const& mesh,
+                                        TransformationMatrix3d const& H,
+                                        size_t i) {
+  const auto& e = H.element;
+  const float mx = mesh.x[i], my = mesh.y[i], mz = mesh.z[i];
+  return {e[0][0] * mx + e[0][1] * my + e[0][2] * mz + e[0][3],
+          e[1][0] * mx + e[1][1] * my + e[1][2] * mz + e[1][3],
+          e[2][0] * mx + e[2][1] * my + e[2][2] * mz + e[2][3]};
+}
+
+// Transforms the vertex positions of the mesh by H into x, y and z.
+static void transform_vertices(RenderMesh const& mesh,
+                               TransformationMatrix3d const& H,
+                               std::vector<float>& x, std::vector<float>& y,
+                               std::vector<float>& z) {
+  const size_t n = mesh.n_vertices();
+  x.resize(n);
+  y.resize(n);
+  z.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    const auto p = transform_vertex(mesh, H, i);
+    x[i] = p[0];
+    y[i] = p[1];
+    z[i] = p[2];
+  }
+}
+
+// Determinant of the linear part of H.
+static float linear_determinant(TransformationMatrix3d const& H) {
+  const auto& e = H.element;
+  return e[0][0] * (e[1][1] * e[2][2] - e[1][2] * e[2][1]) -
+         e[0][1] * (e[1][0] * e[2][2] - e[1][2] * e[2][0]) +
+         e[0][2] * (e[1][0] * e[2][1] - e[1][1] * e[2][0]);
+}
+
+// -1 if H mirrors, which flips the winding of the faces, 1 otherwise.
+static float handedness(TransformationMatrix3d const& H) {
+  return linear_determinant(H) < 0 ? -1.0f : 1.0f;
+}
+
+// Factor by which H scales lengths, for a similarity transform.
+static float similarity_scale(TransformationMatrix3d const& H) {
+  return std::cbrt(std::abs(linear_determinant(H)));
+}
+
+// Direction in model space that H maps onto view, so face visibility can be
+// tested against the model space normals. H is expected to be a similarity
+// transform (rotation, uniform scale and translation); a mirroring H flips
+// the direction, as it flips the faces' winding.
+static OpenMesh::Vec3f model_view_direction(TransformationMatrix3d const& H,
+                                            OpenMesh::Vec3f const& view) {
+  const auto H_inv = H.inverse();
+  auto direction = detail::transform3d(view, H_inv) -
+                   detail::transform3d(OpenMesh::Vec3f{0, 0, 0}, H_inv);
+  return (handedness(H) * direction).normalize();
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef VIEWSPHERE_HPP_
+#define VIEWSPHERE_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include <mesh/mesh.hpp>
+#include <util/constants.h>
+
+// Tessellation of the sphere of view directions into cells, for caching
+// what is seen from nearby directions. Each face of a cube around the sphere
+// is split into side x side cells of equal angle, so cells are at most about
+// 90 / side degrees wide anywhere on the sphere.
+
+// Cells per cube face side for cells about cell_degrees wide. Every
+// direction is then within cell_degrees of the center of its cell.
+static int viewsphere_side(float cell_degrees) {
+  return std::max(1, static_cast<int>(std::ceil(90.0f / cell_degrees)));
+}
+
+static uint32_t viewsphere_cells(int side) { return 6 * side * side; }
+
+namespace detail {
+// Index of a cube face coordinate in [-1, 1] among side cells.
+static inline int viewsphere_coordinate(float a, int side) {
+  const float u = std::atan(a) / constants::quarter_pi<float>();
+  return std::min(side - 1, static_cast<int>((u + 1) * 0.5f * side));
+}
+}
+
+// Cell of the direction, which need not be normalized.
+static uint32_t viewsphere_cell(OpenMesh::Vec3f const& direction, int side) {
+  const float ax = std::abs(direction[0]);
+  const float ay = std::abs(direction[1]);
+  const float az = std::abs(direction[2]);
+  const int major = ax >= std::max(ay, az) ? 0 : (ay >= az ? 1 : 2);
+  const int face = 2 * major + (direction[major] < 0);
+  const float scale = 1 / std::abs(direction[major]);
+  const int i = detail::viewsphere_coordinate(
+      direction[(major + 1) % 3] * scale, side);
+  const int j = detail::viewsphere_coordinate(
+      direction[(major + 2) % 3] * scale, side);
+  return (face * side + i) * side + j;
+}
+
+// Unit direction at the center of the cell.
+static OpenMesh::Vec3f viewsphere_direction(uint32_t cell, int side) {
+  const int j = cell % side;
+  const int i = cell / side % side;
+  const int face = cell / (side * side);
+  const int major = face / 2;
+  auto coordinate = [side](int k) {
+    return std::tan(((k + 0.5f) / side * 2 - 1) *
+                    constants::quarter_pi<float>());
+  };
+  OpenMesh::Vec3f direction;
+  direction[major] = face % 2 ? -1.0f : 1.0f;
+  direction[(major + 1) % 3] = coordinate(i);
+  direction[(major + 2) % 3] = coordinate(j);
+  return direction.normalize();
+}
+
+#endif
@@ -1,14 +1,21 @@
 #ifndef MESH_INTERFACE_HPP
 #define MESH_INTERFACE_HPP
 
+#include <label_mesh.hpp>
 #include <mesh/object_pose.hpp>
 #include <mesh/mesh.hpp>
 #include <mesh/edge_detection.hpp>
 #include <mesh/hidden_surface_removal.hpp>
 #include <mesh/pointcloud.hpp>
+#include <mesh/render_mesh.hpp>
+#include <mesh/viewsphere.hpp>
+#include <util/array2d.h>
 #include <transformations/transformations3d.hpp>
 
 #include <algorithm>
+#include <cmath>
+#include <memory>
+#include <unordered_map>
 
 struct MeshInterface {
 
@@ -16,18 +23,70 @@ struct MeshInterface {
   {
 	  isOpened = false;
   }
-  MeshInterface(char* filename) 
+  // Builds the levels of detail contours are computed from, see
+  // make_mesh_lod.
+  MeshInterface(char* filename, int nsubdivisions = 0,
+                int nsimplifications = 3)
   { 
-	  mesh_ = read_mesh(filename);
-	  isOpened = true;
+	  openMesh(filename, nsubdivisions, nsimplifications);
   }
 
-  void openMesh(char* filename) 
+  // Copies would share the scratch images and render context of the
+  // occlusion test, so are not allowed.
+  MeshInterface(MeshInterface const&) = delete;
+  MeshInterface& operator=(MeshInterface const&) = delete;
+  MeshInterface(MeshInterface&&) = default;
+  MeshInterface& operator=(MeshInterface&&) = default;
+
+  void openMesh(char* filename, int nsubdivisions = 0,
+                int nsimplifications = 3)
   { 
-	  mesh_ = read_mesh(filename); 
+	  lod_ = make_mesh_lod(read_mesh(filename), nsubdivisions,
+	                       nsimplifications);
+	  normals_.clear();
+	  adjacencies_.clear();
+	  trees_.clear();
+	  render_meshes_.clear();
+	  for (auto& level : lod_.levels) {
+	    level.update_normals();
+	    normals_.push_back(get_face_normals(level));
+	    adjacencies_.push_back(
+	        make_edge_adjacency(level, minimum_normal_diff));
+	    trees_.push_back(level.n_faces() < min_tree_faces
+	                         ? SilhouetteTree()
+	                         : build_silhouette_tree(adjacencies_.back(),
+	                                                 normals_.back()));
+	    render_meshes_.push_back(make_render_mesh(level));
+	  }
+	  contour_cache_.clear();
+	  contour_cache_bytes_ = 0;
 	  isOpened = true;
   }
 
+  // Makes get_contour memoize the visible edges of cells of the sphere of
+  // view directions, see viewsphere.hpp, at most cell_degrees wide. Poses in
+  // the same cell then share the edges seen from the cell's center, so
+  // contours are only exact up to the cell size. The cache is emptied when
+  // it would grow beyond max_bytes, and edges of a cell that alone take more
+  // are not cached. cell_degrees <= 0 disables caching.
+  void setContourCache(float cell_degrees, size_t max_bytes = 64 << 20)
+  {
+	  cache_side_ = cell_degrees > 0 ? viewsphere_side(cell_degrees) : 0;
+	  cache_max_bytes_ = max_bytes;
+	  contour_cache_.clear();
+	  contour_cache_bytes_ = 0;
+  }
+
+  // Makes get_contour render the model at the pose and drop the points behind
+  // other parts of it: those where every face seen around the point is
+  // closer than the point by more than depth_tolerance pixels, scaled up
+  // with the face's slope.
+  void setOcclusionCulling(bool enabled, float depth_tolerance = 1.0f)
+  {
+	  occlusion_culling_ = enabled;
+	  depth_tolerance_ = depth_tolerance;
+  }
+
   bool isOpened;
 
   OrientedPointCloud get_contour(float* pose_ptr, float step_size = 1.0f) {
@@ -35,24 +94,151 @@ struct MeshInterface {
     Pose pose;
     std::copy_n(pose_ptr, 6, pose.flatten);
 
-    float minimum_normal_diff = 1.0f;  // radians
     float point_cloud_step_size = step_size / pose.Tz;
 
-    hidden_surface_removal(mesh_, pose_to_direction_vector(pose));
-    auto visible_edges = edge_detection(mesh_, minimum_normal_diff);
+    if (lod_.levels.empty()) return OrientedPointCloud();
+    // pose.Tz scales the model to pixels
+    const size_t level = select_lod(lod_.edge_lengths, pose.Tz);
+    const auto view = pose_to_direction_vector(pose);
+    std::vector<Edge> uncached_edges;
+    std::vector<Edge> const* visible_edges = &uncached_edges;
+    if (cache_side_ > 0) {
+      const uint32_t cell = viewsphere_cell(view, cache_side_);
+      const uint64_t key = level * viewsphere_cells(cache_side_) + cell;
+      auto it = contour_cache_.find(key);
+      if (it != contour_cache_.end()) {
+        visible_edges = &it->second;
+      } else {
+        uncached_edges = get_visible_edges(
+            level, viewsphere_direction(cell, cache_side_));
+        // Edges that alone exceed the cache are used once and not kept.
+        const size_t bytes = uncached_edges.size() * sizeof(Edge);
+        if (bytes <= cache_max_bytes_) {
+          if (contour_cache_bytes_ + bytes > cache_max_bytes_) {
+            contour_cache_.clear();
+            contour_cache_bytes_ = 0;
+          }
+          contour_cache_bytes_ += bytes;
+          it = contour_cache_.emplace(key, std::move(uncached_edges)).first;
+          visible_edges = &it->second;
+        }
+      }
+    } else {
+      uncached_edges = get_visible_edges(level, view);
+    }
     auto oriented_point_cloud =
-        generate_oriented_point_cloud(visible_edges, point_cloud_step_size);
+        generate_oriented_point_cloud(*visible_edges, point_cloud_step_size);
 
     auto H = sil::transformations::make_transform3d(
         pose.Tx, pose.Ty, 0, pose.Rx, pose.Ry, pose.Rz, pose.Tz);
     oriented_point_cloud =
         sil::transformations::transform3d(oriented_point_cloud, H);
+    if (occlusion_culling_) {
+      remove_occluded_points(level, H, oriented_point_cloud);
+    }
 
 	return oriented_point_cloud;
   }
 
  private:
-  Mesh mesh_;
+  // Small levels have no tree, and their faces are all tested against view.
+  std::vector<Edge> get_visible_edges(size_t level,
+                                      OpenMesh::Vec3f const& view) {
+    if (lod_.levels[level].n_faces() < min_tree_faces) {
+      visible_face_bits(normals_[level], view, face_bits_);
+      visible_faces(face_bits_, face_list_);
+      return edge_detection(lod_.levels[level], adjacencies_[level],
+                            face_bits_, face_list_);
+    }
+    return edge_detection(lod_.levels[level], adjacencies_[level],
+                          trees_[level], normals_[level], view);
+  }
+
+  // Points are in pixels, transformed by H like the model.
+  void remove_occluded_points(size_t level, TransformationMatrix3d const& H,
+                              OrientedPointCloud& points) {
+    RenderMesh const& mesh = render_meshes_[level];
+    if (mesh.n_vertices() == 0) return;
+
+    // The model is rendered shifted to start at pixel 0.
+    transform_vertices(mesh, H, x_, y_, z_);
+    const auto x_range = std::minmax_element(x_.begin(), x_.end());
+    const auto y_range = std::minmax_element(y_.begin(), y_.end());
+    const float x_shift = -std::floor(*x_range.first);
+    const float y_shift = -std::floor(*y_range.first);
+    auto shifted = H;
+    shifted.element[0][3] += x_shift;
+    shifted.element[1][3] += y_shift;
+    const int width = static_cast<int>(*x_range.second + x_shift) + 2;
+    const int height = static_cast<int>(*y_range.second + y_shift) + 2;
+    visibility_.Allocate(height, width);
+    if (!context_) context_.reset(new RenderContext());
+    render_mesh(mesh, shifted, VisibilityOutput{visibility_}, *context_);
+
+    // Depth of face f's plane at x, y, and by how much the plane's depth
+    // changes over a pixel.
+    auto plane_depth = [&](uint32_t f, float x, float y, float& slope) {
+      const uint32_t* v = &mesh.indices[3 * f];
+      const OpenMesh::Vec3f p0(x_[v[0]], y_[v[0]], z_[v[0]]);
+      const auto n = (OpenMesh::Vec3f(x_[v[1]], y_[v[1]], z_[v[1]]) - p0) %
+                     (OpenMesh::Vec3f(x_[v[2]], y_[v[2]], z_[v[2]]) - p0);
+      const float gx = -n[0] / n[2], gy = -n[1] / n[2];
+      slope = std::abs(gx) + std::abs(gy);
+      return p0[2] + gx * (x - p0[0]) + gy * (y - p0[1]);
+    };
+
+    // Pixels are sampled at integer coordinates. A point is visible if a face
+    // seen in one of the four pixels around it, extended to the point's
+    // position, is not closer than the point. Faces that contain the point
+    // then pass whatever their slope, and neighbouring faces get a
+    // tolerance growing with theirs.
+    auto occluded = [&](std::tuple<sil::Vec3f, sil::Vec3f> const& point) {
+      const auto& p = std::get<0>(point);
+      const float x = p[0] + x_shift, y = p[1] + y_shift;
+      const int col = std::min(std::max(int(std::floor(x)), 0), width - 2);
+      const int row = std::min(std::max(int(std::floor(y)), 0), height - 2);
+      for (int k = 0; k < 4; ++k) {
+        const int64_t word = visibility_(row + k / 2, col + k % 2);
+        if (word == empty_visibility) return false;
+        float slope;
+        const float z = plane_depth(visible_face(word), p[0], p[1], slope);
+        if (z <= p[2] + depth_tolerance_ * (1 + slope)) return false;
+      }
+      return true;
+    };
+    points.erase(std::remove_if(points.begin(), points.end(), occluded),
+                 points.end());
+  }
+
+  // Creases are edges whose faces' normals differ by more than this.
+  static constexpr float minimum_normal_diff = 1.0f;  // radians
+  // Levels with fewer faces are faster to test face by face than to search
+  // with a SilhouetteTree.
+  static constexpr size_t min_tree_faces = 256;
+
+  MeshLod lod_;
+  // Face normals and edges of every level.
+  std::vector<FaceNormals> normals_;
+  std::vector<EdgeAdjacency> adjacencies_;
+  std::vector<SilhouetteTree> trees_;
+  std::vector<RenderMesh> render_meshes_;
+  // Faces facing the view of levels without a tree.
+  std::vector<uint64_t> face_bits_;
+  std::vector<uint32_t> face_list_;
+
+  // Images and renderer of the occlusion test, see setOcclusionCulling.
+  bool occlusion_culling_ = false;
+  float depth_tolerance_ = 1.0f;
+  std::vector<float> x_, y_, z_;
+  Array2d<int64_t> visibility_;
+  std::unique_ptr<RenderContext> context_;
+
+  // Visible edges by level of detail and viewsphere cell, see
+  // setContourCache.
+  int cache_side_ = 0;
+  size_t cache_max_bytes_ = 0;
+  size_t contour_cache_bytes_ = 0;
+  std::unordered_map<uint64_t, std::vector<Edge>> contour_cache_;
 };
 
 #endif
@@ -0,0 +1,88 @@
+#include <mesh/mesh.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <set>
+#include <tuple>
+#include <vector>
+
+// Checks the levels of detail make_mesh_lod builds from a model, by default
+// the shipped model_triangles.ply, and the levels select_lod picks.
+
+static int nfailures = 0;
+
+static void check(bool condition, char const* what) {
+  if (condition) return;
+  std::cerr << "FAILED: " << what << std::endl;
+  ++nfailures;
+}
+
+static std::set<int> face_labels(Mesh const& mesh) {
+  std::set<int> labels;
+  for (const auto& face : mesh.faces()) labels.insert(mesh.data(face).label);
+  return labels;
+}
+
+static std::set<std::tuple<float, float, float>> points(
+    Mesh const& mesh, bool boundary_only) {
+  std::set<std::tuple<float, float, float>> result;
+  for (const auto& vertex : mesh.vertices()) {
+    if (boundary_only && !mesh.is_boundary(vertex)) continue;
+    const auto& p = mesh.point(vertex);
+    result.emplace(p[0], p[1], p[2]);
+  }
+  return result;
+}
+
+int main(int argc, char* argv[]) {
+  const Mesh mesh = read_mesh(argc > 1 ? argv[1] : "model_triangles.ply");
+  check(mesh.n_faces() >= 64, "the model has enough faces to simplify");
+
+  // One subdivided level, the model, and simplified levels down to 16 faces.
+  const auto lod = make_mesh_lod(mesh, 1, 2, 16);
+  check(lod.levels.size() == 4, "all levels are built");
+  check(lod.edge_lengths.size() == lod.levels.size(),
+        "every level has an edge length");
+  if (lod.levels.size() != 4) return 1;
+  check(lod.levels[1].n_faces() == mesh.n_faces(),
+        "the model itself is level 1");
+
+  for (size_t i = 1; i < lod.levels.size(); ++i) {
+    check(lod.levels[i].n_faces() < lod.levels[i - 1].n_faces(),
+          "face counts decrease from level to level");
+    check(lod.edge_lengths[i] > lod.edge_lengths[i - 1],
+          "edges grow from level to level");
+  }
+
+  const auto labels = face_labels(mesh);
+  check(face_labels(lod.levels[0]) == labels,
+        "subdivision keeps every face label");
+  for (size_t i = 2; i < lod.levels.size(); ++i) {
+    const auto level_labels = face_labels(lod.levels[i]);
+    check(std::includes(labels.begin(), labels.end(), level_labels.begin(),
+                        level_labels.end()),
+          "simplification only keeps labels of the model");
+  }
+
+  const auto boundary = points(mesh, true);
+  for (size_t i = 2; i < lod.levels.size(); ++i) {
+    const auto level_points = points(lod.levels[i], false);
+    check(std::includes(level_points.begin(), level_points.end(),
+                        boundary.begin(), boundary.end()),
+          "simplification keeps the boundary vertices in place");
+  }
+
+  // Level i is picked when its edges span just under 2 pixels.
+  for (size_t i = 0; i < lod.levels.size(); ++i) {
+    const float pixels_per_unit = 1.99f / lod.edge_lengths[i];
+    check(select_lod(lod.edge_lengths, pixels_per_unit) == i,
+          "select_lod picks the level whose edges span 2 pixels");
+  }
+  check(select_lod(lod.edge_lengths, 1e6f) == 0,
+        "select_lod picks the finest level when zoomed in");
+  check(select_lod(lod.edge_lengths, 1e-6f) == lod.levels.size() - 1,
+        "select_lod picks the coarsest level when zoomed out");
+
+  if (nfailures == 0) std::cout << "mesh_lod_test passed" << std::endl;
+  return nfailures == 0 ? 0 : 1;
+}
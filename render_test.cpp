@@ -0,0 +1,184 @@
+#include <label_mesh.hpp>
+#include <mesh/mesh.hpp>
+#include <mesh/render_mesh.hpp>
+#include <transformations/transformations3d.hpp>
+#include <util/array2d.h>
+#include <util/array3d.h>
+
+#include <iostream>
+#include <vector>
+
+// Checks that renders of a model, by default the shipped
+// model_triangles.ply, agree exactly whatever they are made with: every
+// output policy, one or several workers, meshes sorted by view or with a
+// bounding volume hierarchy, and the batch entry point.
+
+static int nfailures = 0;
+
+static void check(bool condition, char const* what) {
+  if (condition) return;
+  std::cerr << "FAILED: " << what << std::endl;
+  ++nfailures;
+}
+
+template <typename T>
+static bool same(ConstArray2dView<T> a, ConstArray2dView<T> b) {
+  if (a.GetSize0() != b.GetSize0() || a.GetSize1() != b.GetSize1())
+    return false;
+  for (size_t row = 0; row < a.GetSize0(); ++row) {
+    for (size_t col = 0; col < a.GetSize1(); ++col) {
+      if (a(row, col) != b(row, col)) return false;
+    }
+  }
+  return true;
+}
+
+template <typename T>
+static Array2dView<T> slice(Array3d<T>& stack, int i) {
+  return Array2dView<T>(&stack(i, 0, 0), stack.GetSize1(), stack.GetSize2(),
+                        stack.GetSize2());
+}
+
+const int width = 200, height = 150;
+
+// Compares every render of the poses against the depth and labels of the
+// plain mesh rendered with one worker.
+template <typename Camera>
+static void check_poses(std::vector<RenderMesh> const& meshes,
+                        std::vector<TransformationMatrix3d> const& poses,
+                        std::vector<RenderContext*> const& contexts,
+                        Camera const& camera) {
+  RenderContext& reference_context = *contexts[0];
+  const auto& reference_mesh = meshes[0];
+
+  Array2d<int> labels(height, width), other_labels(height, width);
+  Array2d<float> depth(height, width), other_depth(height, width);
+  Array2d<int64_t> visibility(height, width), other_visibility(height, width);
+  Array2d<unsigned char> mask(height, width), covered(height, width);
+
+  for (const auto& H : poses) {
+    render_mesh(reference_mesh, H, DepthAndLabelOutput{labels, depth},
+                reference_context, camera);
+    render_mesh(reference_mesh, H, VisibilityOutput{visibility},
+                reference_context, camera);
+    int ncovered = 0;
+    for (int row = 0; row < height; ++row) {
+      for (int col = 0; col < width; ++col) {
+        covered(row, col) = visibility(row, col) != empty_visibility;
+        ncovered += covered(row, col);
+      }
+    }
+    check(ncovered > 0, "the model is in view");
+
+    resolve_visibility(reference_mesh, visibility, other_labels, other_depth,
+                       camera);
+    check(same<int>(other_labels, labels),
+          "resolved visibility has the labels of DepthAndLabelOutput");
+    check(same<float>(other_depth, depth),
+          "resolved visibility has the depth of DepthAndLabelOutput");
+
+    for (const auto& mesh : meshes) {
+      for (RenderContext* context : contexts) {
+        render_mesh(mesh, H, DepthAndLabelOutput{other_labels, other_depth},
+                    *context, camera);
+        check(same<int>(other_labels, labels),
+              "DepthAndLabelOutput labels match");
+        check(same<float>(other_depth, depth),
+              "DepthAndLabelOutput depth matches");
+
+        render_mesh(mesh, H, DepthOutput{other_depth}, *context, camera);
+        check(same<float>(other_depth, depth), "DepthOutput matches");
+
+        render_mesh(mesh, H, LabelOutput{other_labels}, *context, camera);
+        check(same<int>(other_labels, labels), "LabelOutput matches");
+
+        render_mesh(mesh, H, MaskOutput{mask}, *context, camera);
+        check(same<unsigned char>(mask, covered),
+              "MaskOutput covers the pixels of VisibilityOutput");
+
+        render_mesh(mesh, H, VisibilityOutput{other_visibility}, *context,
+                    camera);
+        check(same<int64_t>(other_visibility, visibility),
+              "VisibilityOutput matches");
+
+        render_mesh(mesh, H, FaceParallelVisibilityOutput{other_visibility},
+                    *context, camera);
+        check(same<int64_t>(other_visibility, visibility),
+              "FaceParallelVisibilityOutput matches VisibilityOutput");
+      }
+    }
+  }
+
+  // Batches with fewer poses than workers share frames among the workers,
+  // others render whole poses on every worker.
+  for (size_t npose : {size_t(2), poses.size()}) {
+    const std::vector<TransformationMatrix3d> batch(poses.begin(),
+                                                    poses.begin() + npose);
+    Array3d<int> label_stack;
+    Array3d<float> depth_stack;
+    label_stack.Allocate(npose, height, width);
+    depth_stack.Allocate(npose, height, width);
+    for (const auto& mesh : meshes) {
+      for (RenderContext* context : contexts) {
+        get_projected_depth_and_label(mesh, batch, label_stack, depth_stack,
+                                      *context, camera);
+        for (size_t i = 0; i < npose; ++i) {
+          render_mesh(reference_mesh, batch[i],
+                      DepthAndLabelOutput{labels, depth}, reference_context,
+                      camera);
+          check(same<int>(slice(label_stack, i), labels),
+                "batch labels match single renders");
+          check(same<float>(slice(depth_stack, i), depth),
+                "batch depth matches single renders");
+        }
+      }
+    }
+  }
+}
+
+int main(int argc, char* argv[]) {
+  using namespace sil::transformations;
+  const Mesh model = read_mesh(argc > 1 ? argv[1] : "model_triangles.ply");
+
+  // The subdivided model has enough faces for several runs of view_order_run
+  // faces to sort and cull.
+  const auto lod = make_mesh_lod(model, 1, 0);
+  std::vector<RenderMesh> meshes(3, make_render_mesh(lod.levels[0]));
+  check(n_face_runs(meshes[0]) > 4, "the mesh has several face runs");
+  sort_faces_by_view(meshes[1]);
+  sort_faces_by_view(meshes[2]);
+  build_face_bvh(meshes[2]);
+
+  RenderContext one_worker(1), four_workers(4);
+  const std::vector<RenderContext*> contexts = {&one_worker, &four_workers};
+
+  // Views from several sides, one cut off by the image borders and one
+  // reaching far beyond them.
+  std::vector<TransformationMatrix3d> orthographic;
+  const float angles[][3] = {{0, 0, 0}, {1.57f, 0, 0}, {0.3f, 2.5f, 0.7f},
+                             {-2.0f, 0.4f, 3.0f}};
+  for (const auto& a : angles) {
+    orthographic.push_back(translate3d(100.0f, 75.0f, 0.0f) *
+                           rotate3d(a[0], a[1], a[2]) * scale3d(15.0f));
+  }
+  orthographic.push_back(translate3d(20.0f, 10.0f, 0.0f) *
+                         rotate3d(0.5f, 0.5f, 0.5f) * scale3d(20.0f));
+  orthographic.push_back(translate3d(100.0f, 75.0f, 0.0f) *
+                         rotate3d(0.2f, 1.0f, 0.0f) * scale3d(2000.0f));
+  check_poses(meshes, orthographic, contexts, OrthographicCamera());
+
+  // Pinhole views from afar and from close by, the latter with faces
+  // crossing the near plane.
+  std::vector<TransformationMatrix3d> pinhole;
+  for (const auto& a : angles) {
+    pinhole.push_back(translate3d(0.0f, 0.0f, 10.0f) *
+                      rotate3d(a[0], a[1], a[2]));
+  }
+  pinhole.push_back(translate3d(2.0f, 0.0f, 2.0f) *
+                    rotate3d(0.4f, 1.0f, 0.0f));
+  check_poses(meshes, pinhole, contexts,
+              PinholeCamera{150.0f, 150.0f, 100.0f, 75.0f, 0.1f});
+
+  if (nfailures == 0) std::cout << "render_test passed" << std::endl;
+  return nfailures == 0 ? 0 : 1;
+}
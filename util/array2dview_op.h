@@ -408,7 +408,8 @@ BINARY_OP_FUNCTORS(bitwise_or, | )
 #define BINARY_OP_FUNCTORS_SSE(name, op)                                \
   struct name##_sse {                                                   \
     void operator()(const float* src1, const float* src2, float* dst) { \
-      Store(dst, _mm_##name##_ps(Load(src1), Load(src2)));              \
+      SSENAME(Store)(dst, _mm_##name##_ps(SSENAME(Load)(src1),          \
+                                          SSENAME(Load)(src2)));        \
     }                                                                   \
   };
 
@@ -1,4 +1,5 @@
 #include <cmath>
+#include <cstdint>
 
 #if defined(__SSE__) || defined(__AVX__) || defined(__SSE4__)
 #include <immintrin.h>
@@ -97,6 +98,24 @@ __forceinline void SSENAME(Store)(float* p, __m128 src) {
   return _mm_storeu_ps(p, src);
 }
 
+__forceinline __m128i SSENAME(Load)(const int* p) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+__forceinline void SSENAME(Store)(int* p, __m128i src) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(p), src);
+}
+
+#ifdef __AVX__
+__forceinline __m256i AVXNAME(Load)(const int* p) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+__forceinline void AVXNAME(Store)(int* p, __m256i src) {
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), src);
+}
+#endif
+
 #ifdef __AVX__
 __forceinline void AVXNAME(Store)(float* p, __m256 src) {
   return _mm256_storeu_ps(p, src);
@@ -153,6 +172,22 @@ __forceinline __m256 AVXNAME(Blend)(__m256i mask, __m256 first, __m256 second) {
 }
 #endif
 
+#ifdef __SSE4__
+__forceinline __m128i SSENAME(Blend)(__m128i mask, __m128i first,
+                                     __m128i second) {
+  return _mm_blendv_epi8(second, first, mask);
+}
+#endif
+
+#ifdef __AVX__
+__forceinline __m256i AVXNAME(Blend)(__m256i mask, __m256i first,
+                                     __m256i second) {
+  return _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(second),
+                                               _mm256_castsi256_ps(first),
+                                               _mm256_castsi256_ps(mask)));
+}
+#endif
+
 #ifdef __SSE4__
 __forceinline __m128 SSENAME(GatherDefault0)(float* p, __m128i idx,
                                              __m128i vmask) {
@@ -457,7 +492,20 @@ __forceinline __m128i SSENAME(CmpNe)(__m128i a, __m128i b) {
   return _mm_xor_si128(_mm_set1_epi32(-1), _mm_cmpeq_epi32(a, b));
 }
 
-#ifdef __AVX__
+#if defined(__AVX2__)
+__forceinline __m256i AVXNAME(CmpLt)(__m256i a, __m256i b) {
+  return _mm256_cmpgt_epi32(b, a);
+}
+__forceinline __m256i AVXNAME(CmpGe)(__m256i a, __m256i b) {
+  return _mm256_xor_si256(_mm256_set1_epi32(-1), _mm256_cmpgt_epi32(b, a));
+}
+__forceinline __m256i AVXNAME(CmpEq)(__m256i a, __m256i b) {
+  return _mm256_cmpeq_epi32(a, b);
+}
+__forceinline __m256i AVXNAME(CmpNe)(__m256i a, __m256i b) {
+  return _mm256_xor_si256(_mm256_set1_epi32(-1), _mm256_cmpeq_epi32(a, b));
+}
+#elif defined(__AVX__)
 SSE_INT_BINARY_TO_AVX(CmpLt)
 SSE_INT_BINARY_TO_AVX(CmpGe)
 SSE_INT_BINARY_TO_AVX(CmpEq)
@@ -474,6 +522,16 @@ __forceinline __m256i AVXNAME(CmpGt)(__m256 a, __m256 b) {
 }
 #endif
 
+__forceinline __m128i SSENAME(CmpGe)(__m128 a, __m128 b) {
+  return _mm_castps_si128(_mm_cmpge_ps(a, b));
+}
+
+#ifdef __AVX__
+__forceinline __m256i AVXNAME(CmpGe)(__m256 a, __m256 b) {
+  return _mm256_castps_si256(_mm256_cmp_ps(a, b, 0xd));
+}
+#endif
+
 #ifdef __SSE4__
 __forceinline int SSENAME(AllEqual)(__m128i a, __m128i b) {
   __m128i eq = _mm_xor_si128(a, b);
@@ -512,6 +570,19 @@ __forceinline int AVXNAME(AllSet)(__m256i a) {
 }
 #endif
 
+// Bit i is set if lane i of the mask is set.
+#ifdef __SSE4__
+__forceinline int SSENAME(MoveMask)(__m128i a) {
+  return _mm_movemask_ps(_mm_castsi128_ps(a));
+}
+#endif
+
+#ifdef __AVX__
+__forceinline int AVXNAME(MoveMask)(__m256i a) {
+  return _mm256_movemask_ps(_mm256_castsi256_ps(a));
+}
+#endif
+
 __forceinline __m128i SSENAME(Add)(__m128i a, __m128i b) {
   return _mm_add_epi32(a, b);
 }
@@ -525,7 +596,17 @@ __forceinline __m128i SSENAME(Mul)(__m128i a, __m128i b) {
 }
 #endif
 
-#ifdef __AVX__
+#if defined(__AVX2__)
+__forceinline __m256i AVXNAME(Add)(__m256i a, __m256i b) {
+  return _mm256_add_epi32(a, b);
+}
+__forceinline __m256i AVXNAME(Sub)(__m256i a, __m256i b) {
+  return _mm256_sub_epi32(a, b);
+}
+__forceinline __m256i AVXNAME(Mul)(__m256i a, __m256i b) {
+  return _mm256_mullo_epi32(a, b);
+}
+#elif defined(__AVX__)
 SSE_INT_BINARY_TO_AVX(Add)
 SSE_INT_BINARY_TO_AVX(Sub)
 SSE_INT_BINARY_TO_AVX(Mul)
@@ -569,7 +650,17 @@ __forceinline __m128i SSENAME(Or)(__m128i a, __m128i b) {
   return _mm_or_si128(a, b);
 }
 
-#ifdef __AVX__
+#if defined(__AVX2__)
+__forceinline __m256i AVXNAME(And)(__m256i a, __m256i b) {
+  return _mm256_and_si256(a, b);
+}
+__forceinline __m256i AVXNAME(AndNot)(__m256i a, __m256i b) {
+  return _mm256_andnot_si256(b, a);
+}
+__forceinline __m256i AVXNAME(Or)(__m256i a, __m256i b) {
+  return _mm256_or_si256(a, b);
+}
+#elif defined(__AVX__)
 SSE_INT_BINARY_TO_AVX(And)
 SSE_INT_BINARY_TO_AVX(AndNot)
 SSE_INT_BINARY_TO_AVX(Or)
@@ -592,6 +683,70 @@ __forceinline __m256 AVXNAME(ToFloat)(__m256i a) {
 }
 #endif
 
+__forceinline __m128i SSENAME(AsInt)(__m128 a) { return _mm_castps_si128(a); }
+
+#ifdef __AVX__
+__forceinline __m256i AVXNAME(AsInt)(__m256 a) {
+  return _mm256_castps_si256(a);
+}
+#endif
+
+// Packs hi and lo of every lane into a signed 64-bit value, hi in the upper
+// half, and where mask is set stores it at p if it is larger.
+#if defined(__SSE4_2__)
+__forceinline void SSENAME(StoreMaxPacked)(int64_t* p, __m128i hi, int lo,
+                                           __m128i mask) {
+  const __m128i low = _mm_set1_epi64x(static_cast<uint32_t>(lo));
+  for (int half = 0; half < 2; ++half) {
+    const __m128i h = half ? _mm_unpackhi_epi32(hi, hi) : _mm_unpacklo_epi32(hi, hi);
+    const __m128i m = half ? _mm_unpackhi_epi32(mask, mask)
+                           : _mm_unpacklo_epi32(mask, mask);
+    const __m128i packed = _mm_or_si128(
+        _mm_slli_epi64(_mm_srli_epi64(h, 32), 32), low);
+    __m128i* q = reinterpret_cast<__m128i*>(p + 2 * half);
+    const __m128i old = _mm_loadu_si128(q);
+    const __m128i write = _mm_and_si128(m, _mm_cmpgt_epi64(packed, old));
+    _mm_storeu_si128(q, _mm_blendv_epi8(old, packed, write));
+  }
+}
+#else
+inline void SSENAME(StoreMaxPacked)(int64_t* p, __m128i hi, int lo,
+                                    __m128i mask) {
+  int h[4], m[4];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(h), hi);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(m), mask);
+  for (int k = 0; k < 4; ++k) {
+    const int64_t packed = static_cast<int64_t>(
+        static_cast<uint64_t>(h[k]) << 32 | static_cast<uint32_t>(lo));
+    if (m[k] && packed > p[k]) p[k] = packed;
+  }
+}
+#endif
+
+#if defined(__AVX2__)
+__forceinline void AVXNAME(StoreMaxPacked)(int64_t* p, __m256i hi, int lo,
+                                           __m256i mask) {
+  const __m256i low = _mm256_set1_epi64x(static_cast<uint32_t>(lo));
+  for (int half = 0; half < 2; ++half) {
+    const __m128i h = half ? HighInt4(hi) : LowInt4(hi);
+    const __m128i m = half ? HighInt4(mask) : LowInt4(mask);
+    const __m256i packed = _mm256_or_si256(
+        _mm256_slli_epi64(_mm256_cvtepi32_epi64(h), 32), low);
+    __m256i* q = reinterpret_cast<__m256i*>(p + 4 * half);
+    const __m256i old = _mm256_loadu_si256(q);
+    const __m256i write =
+        _mm256_and_si256(_mm256_cvtepi32_epi64(m), _mm256_cmpgt_epi64(packed, old));
+    _mm256_storeu_si256(q, _mm256_blendv_epi8(old, packed, write));
+  }
+}
+#elif defined(__AVX__)
+__forceinline void AVXNAME(StoreMaxPacked)(int64_t* p, __m256i hi, int lo,
+                                           __m256i mask) {
+  SSENAME(StoreMaxPacked)(p, LowInt4(hi), lo, LowInt4(mask));
+  SSENAME(StoreMaxPacked)(p + 4, HighInt4(hi), lo, HighInt4(mask));
+}
+#endif
+
 #ifdef __SSE4__
 __forceinline __m128 SSENAME(Floor)(__m128 a) { return _mm_floor_ps(a); }
 #else
@@ -621,6 +776,17 @@ __forceinline __m128 SSENAME(Set1)(float a) { return _mm_set1_ps(a); }
 __forceinline __m256 AVXNAME(Set1)(float a) { return _mm256_set1_ps(a); }
 #endif
 
+// Consecutive integers start, start + 1, ... in the lanes.
+__forceinline __m128i SSENAME(Ramp)(int a) {
+  return _mm_setr_epi32(a, a + 1, a + 2, a + 3);
+}
+
+#ifdef __AVX__
+__forceinline __m256i AVXNAME(Ramp)(int a) {
+  return _mm256_setr_epi32(a, a + 1, a + 2, a + 3, a + 4, a + 5, a + 6, a + 7);
+}
+#endif
+
 template <typename T>
 __forceinline T SCALARNAME(Blend)(int cond, T first, T second) {
   return cond ? first : second;
@@ -667,6 +833,7 @@ __forceinline int SCALARNAME(CmpGt)(float a, float b) { return a > b ? 1 : 0; }
 
 __forceinline bool SCALARNAME(AllEqual)(int a, int b) { return a == b; }
 __forceinline bool SCALARNAME(AllZero)(int a) { return a == 0; }
+__forceinline int SCALARNAME(MoveMask)(int a) { return a != 0; }
 
 __forceinline int SCALARNAME(And)(int a, int b) { return a & b; }
 __forceinline int SCALARNAME(AndNot)(int a, int b) { return a & ~b; }
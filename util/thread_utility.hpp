@@ -4,6 +4,10 @@
 #include <vector>
 #include <utility>
 #include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cassert>
 
 std::vector<std::pair<int, int>> distribute_uniform_workload(
     std::pair<int, int> interval, size_t nworkers) {
@@ -23,4 +27,70 @@ std::vector<std::pair<int, int>> distribute_uniform_workload(
   return batches;
 }
 
+// Runs jobs on a fixed set of threads that are started once, so running a
+// job neither starts threads nor allocates.
+class WorkerPool {
+ public:
+  explicit WorkerPool(size_t nworkers) {
+    for (size_t worker = 1; worker < nworkers; ++worker)
+      threads.emplace_back(&WorkerPool::loop, this, worker);
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    start.notify_all();
+    for (auto& thread : threads) thread.join();
+  }
+
+  WorkerPool(WorkerPool const&) = delete;
+  WorkerPool& operator=(WorkerPool const&) = delete;
+
+  size_t size() const { return threads.size() + 1; }
+
+  // Calls job(worker) for worker = 0 .. size() - 1. Worker 0 runs on the
+  // calling thread. Returns when all workers are done.
+  template <typename Job>
+  void run(Job& job) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      call = [](void* job, size_t worker) { (*static_cast<Job*>(job))(worker); };
+      this->job = &job;
+      pending = threads.size();
+      ++generation;
+    }
+    start.notify_all();
+    job(0);
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return pending == 0; });
+  }
+
+ private:
+  void loop(size_t worker) {
+    size_t seen = 0;
+    for (;;) {
+      std::unique_lock<std::mutex> lock(mutex);
+      start.wait(lock, [&] { return stop || generation != seen; });
+      if (stop) return;
+      seen = generation;
+      lock.unlock();
+      call(job, worker);
+      lock.lock();
+      if (--pending == 0) done.notify_one();
+    }
+  }
+
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable start;
+  std::condition_variable done;
+  void (*call)(void*, size_t) = nullptr;
+  void* job = nullptr;
+  size_t pending = 0;
+  size_t generation = 0;
+  bool stop = false;
+};
+
 #endif